@@ -0,0 +1,49 @@
+#include "Clock.hpp"
+
+#include <thread>
+
+namespace {
+	using namespace Procon;
+
+	class SteadyClock final : public Clock {
+	public:
+		time_point now() const override {
+			return std::chrono::steady_clock::now();
+		}
+		void sleepFor(duration d) override {
+			std::this_thread::sleep_for(d);
+		}
+		void yield() override {
+			std::this_thread::yield();
+		}
+	};
+};
+
+namespace Procon {
+
+	Clock& Clock::steady() {
+		static SteadyClock clock;
+		return clock;
+	}
+
+	VirtualClock::VirtualClock(duration yieldCost) :yieldCost(yieldCost) {}
+
+	Clock::time_point VirtualClock::now() const {
+		return current;
+	}
+
+	void VirtualClock::sleepFor(duration d) {
+		current += d;
+	}
+
+	void VirtualClock::yield() {
+		current += yieldCost;
+	}
+
+	void VirtualClock::advanceTo(time_point t) {
+		if (t > current) {
+			current = t;
+		}
+	}
+
+};
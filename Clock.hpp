@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+
+namespace Procon {
+
+	// Time source for everything timing dependent: polling, status updates,
+	// idle detection and the watchdog. Normally the real steady_clock, a
+	// VirtualClock in simulations so hours of activity run in moments.
+	class Clock {
+	public:
+		using time_point = std::chrono::steady_clock::time_point;
+		using duration = std::chrono::steady_clock::duration;
+
+		virtual ~Clock() = default;
+
+		virtual time_point now() const = 0;
+		virtual void sleepFor(duration d) = 0;
+		virtual void yield() = 0;
+
+		// The real clock, shared by everything not simulated
+		static Clock& steady();
+	};
+
+	// Simulated time that only moves when something waits on it
+	class VirtualClock final : public Clock {
+	public:
+		// yieldCost is how far a yield() moves time, what a spin of the loop costs
+		explicit VirtualClock(duration yieldCost = std::chrono::microseconds(20));
+
+		time_point now() const override;
+		void sleepFor(duration d) override;
+		void yield() override;
+
+		// Jumps forward to t, never backwards
+		void advanceTo(time_point t);
+
+	private:
+		time_point current{};
+		duration yieldCost;
+	};
+
+};
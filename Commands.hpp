@@ -0,0 +1,275 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "Common.hpp"
+
+namespace Procon {
+
+	constexpr size_t exchangeLen{ 0x400 }; // Bytes read per reply
+	constexpr size_t maxCommandLen{ 64 }; // Bytes written per command
+	constexpr int maxReplyReads{ 8 }; // Reports read per pump while waiting for a subcommand reply
+	constexpr int subcommandReplyData{ 25 }; // Offset of subcommand reply data in a USB reply
+
+	// A command sequence: a coroutine that co_awaits replies from its
+	// controller's CommandQueue. Starts suspended, the queue runs it.
+	class CommandTask {
+	public:
+		struct promise_type {
+			std::exception_ptr error;
+
+			CommandTask get_return_object() {
+				return CommandTask{ std::coroutine_handle<promise_type>::from_promise(*this) };
+			}
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			std::suspend_always final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() {
+				error = std::current_exception();
+			}
+		};
+
+		CommandTask() = default;
+		CommandTask(CommandTask &&other) noexcept :handle(std::exchange(other.handle, nullptr)) {}
+		CommandTask& operator=(CommandTask &&other) noexcept {
+			if (this != &other) {
+				reset();
+				handle = std::exchange(other.handle, nullptr);
+			}
+			return *this;
+		}
+		CommandTask(const CommandTask&) = delete;
+		CommandTask& operator=(const CommandTask&) = delete;
+		~CommandTask() {
+			reset();
+		}
+
+		explicit operator bool() const {
+			return static_cast<bool>(handle);
+		}
+		bool done() const {
+			return handle.done();
+		}
+		void resume() {
+			handle.resume();
+		}
+		std::exception_ptr error() const {
+			return handle.promise().error;
+		}
+		void reset() {
+			if (handle) {
+				handle.destroy();
+				handle = nullptr;
+			}
+		}
+
+	private:
+		explicit CommandTask(std::coroutine_handle<promise_type> handle) :handle(handle) {}
+
+		std::coroutine_handle<promise_type> handle{};
+	};
+
+	// What a co_await on CommandQueue::send() gives back. data is only valid
+	// until the sequence sends its next command.
+	struct CommandReply {
+		int length; // Bytes read, 0 if no reply came in time, -1 if the write or read failed
+		const uchar *data;
+	};
+
+	// Per-controller dispatcher for command sequences.
+	// Sequences run one after another. pump() never blocks: it writes the
+	// command the running sequence waits on, reads its reply if one has
+	// arrived, and resumes the sequence. One thread can pump any number of
+	// controllers' queues between input polls.
+	class CommandQueue {
+	public:
+		using clock = std::chrono::steady_clock;
+
+		class Awaiter {
+		public:
+			explicit Awaiter(CommandQueue &queue) :queue(queue) {}
+			bool await_ready() const noexcept {
+				return false;
+			}
+			void await_suspend(std::coroutine_handle<>) const noexcept {}
+			CommandReply await_resume() const noexcept {
+				return { queue.replyLength, queue.reply.data() };
+			}
+		private:
+			CommandQueue &queue;
+		};
+
+		// Queues a sequence to run after the ones already queued
+		void start(CommandTask task) {
+			queued.push_back(std::move(task));
+		}
+		bool busy() const {
+			return static_cast<bool>(current) || !queued.empty();
+		}
+		// Drops every sequence, for when the device is gone
+		void clear() {
+			current.reset();
+			queued.clear();
+			stage = Stage::Idle;
+		}
+
+		// co_await from a sequence. With a subcommand, only its 0x21 reply
+		// counts and input reports read meanwhile go to pump()'s input,
+		// otherwise the first reply does.
+		template<size_t len>
+		Awaiter send(const std::array<uchar, len> &data, std::optional<uchar> subcommand = {}) {
+			static_assert(len <= maxCommandLen, "Command too long");
+			std::memcpy(pending.data(), data.data(), len);
+			pendingLength = len;
+			expected = subcommand;
+			stage = Stage::Write;
+			return Awaiter{ *this };
+		}
+
+		// The global packet number every rumble and subcommand packet carries
+		uchar nextPacket() {
+			return static_cast<uchar>(packetCounter++ & 0xF);
+		}
+
+		// Advances the running sequence as far as it goes without waiting on
+		// the device. write(data, length) and read(buffer, length) are the
+		// device's, read must not block. input(data, length) gets every other
+		// report read while waiting for a subcommand reply. A reply that
+		// doesn't come within timeout resumes the sequence with length 0.
+		// Returns true while any sequence is left, rethrows what a sequence
+		// threw and drops the rest.
+		template<class Write, class Read, class Input>
+		bool pump(clock::time_point now, std::chrono::milliseconds timeout, Write &&write, Read &&read, Input &&input) {
+			while (current || startNext()) {
+				if (stage == Stage::Write) {
+					if (write(pending.data(), pendingLength) < 0) {
+						finishExchange(-1);
+						continue;
+					}
+					stage = Stage::Read;
+					deadline = now + timeout;
+				}
+				if (stage == Stage::Read) {
+					int length{ 0 };
+					for (int reads{ 0 }; reads < maxReplyReads; ++reads) {
+						length = read(reply.data(), reply.size());
+						if (length <= 0 || matches(length)) {
+							break;
+						}
+						input(reply.data(), length); // Not the reply, an input report that came first
+						length = 0;
+					}
+					if (length != 0 || now >= deadline) {
+						finishExchange(length);
+						continue;
+					}
+					return true; // Still waiting on the device
+				}
+				// Suspended on something other than send(), let it carry on
+				if (current) {
+					resumeCurrent();
+				}
+			}
+			return false;
+		}
+
+	private:
+		enum class Stage : uchar {
+			Idle, // Nothing to send, the sequence finished or hasn't started
+			Write, // The sequence waits on pending, not written yet
+			Read // Written, waiting for the reply
+		};
+
+		bool startNext() {
+			if (queued.empty()) {
+				return false;
+			}
+			current = std::move(queued.front());
+			queued.pop_front();
+			stage = Stage::Idle;
+			resumeCurrent();
+			return true;
+		}
+
+		bool matches(int length) const {
+			return !expected || (length > subcommandReplyData && reply[10] == 0x21 && reply[24] == *expected);
+		}
+
+		void finishExchange(int length) {
+			replyLength = length;
+			stage = Stage::Idle;
+			resumeCurrent();
+		}
+
+		// Runs the sequence to its next co_await or its end
+		void resumeCurrent() {
+			current.resume();
+			if (!current.done()) {
+				return;
+			}
+			const std::exception_ptr error{ current.error() };
+			current.reset();
+			if (error) {
+				clear();
+				std::rethrow_exception(error);
+			}
+		}
+
+		CommandTask current;
+		std::deque<CommandTask> queued;
+		Stage stage{ Stage::Idle };
+		std::array<uchar, maxCommandLen> pending{};
+		size_t pendingLength{ 0 };
+		std::optional<uchar> expected;
+		clock::time_point deadline{};
+		std::array<uchar, exchangeLen> reply{};
+		int replyLength{ 0 };
+		uchar packetCounter{ 0 };
+	};
+
+	// USB command, what every exchange with a wired Procon starts with
+	template<size_t len>
+	std::array<uchar, len + 0x9> usbCommand(uchar command, const std::array<uchar, len> &data) {
+		std::array<uchar, len + 0x9> buf{};
+		buf[0x0] = 0x80;
+		buf[0x1] = 0x92;
+		buf[0x3] = 0x31;
+		buf[0x8] = command;
+		if constexpr (len > 0) {
+			std::memcpy(buf.data() + 0x9, data.data(), len);
+		}
+		return buf;
+	}
+
+	// Subcommand packet with neutral rumble, sent with usbCommand(0x1, ...)
+	template<size_t len>
+	std::array<uchar, 10 + len> subcommandPacket(uchar packet, uchar subcommand, const std::array<uchar, len> &data) {
+		std::array<uchar, 10 + len> buf{ packet, 0x00, 0x01, 0x40, 0x40, 0x00, 0x01, 0x40, 0x40, subcommand };
+		if constexpr (len > 0) {
+			std::memcpy(buf.data() + 10, data.data(), len);
+		}
+		return buf;
+	}
+
+	// Rumble packet for both motors, sent with usbCommand(0x10, ...)
+	inline std::array<uchar, 9> rumblePacket(uchar packet, uchar largeMotor, uchar smallMotor) {
+		std::array<uchar, 9> buf{ packet, 0x80, 0x00, 0x40, 0x40, 0x80, 0x00, 0x40, 0x40 };
+		if (largeMotor != 0) {
+			buf[1] = buf[5] = 0x08;
+			buf[2] = buf[6] = largeMotor;
+		}
+		else if (smallMotor != 0) {
+			buf[1] = buf[5] = 0x10;
+			buf[2] = buf[6] = smallMotor;
+		}
+		return buf;
+	}
+
+};
@@ -34,7 +34,7 @@ namespace {
 	};
 
 	template<class T>
-	void readConfig(const string& line) {
+	void readConfig(const string& line, const string& scope) {
 		stringstream s{ line };
 		stringstream name;
 		T value;
@@ -50,14 +50,14 @@ namespace {
 			error << "Error parsing config line : \n" << line << "\nException: " << e.what();
 			throw ConfigError(error.str());
 		}
-		Config::store(name.str(), value);
+		Config::store(scope + name.str(), value);
 	}
 
 }; // namespace
 
 
 
-void Config::readConfigFile(const string& filename) {
+void Config::readConfigFile(const string& filename, const string& scope) {
 	ifstream file;
 	file.open(filename);
 	if (!file.good()) {
@@ -74,23 +74,23 @@ void Config::readConfigFile(const string& filename) {
 
 		switch (type->second) {
 		case ConfigType::Boolean:
-			readConfig<bool>(line);
+			readConfig<bool>(line, scope);
 			break;
 			
 		case ConfigType::Double:
-			readConfig<double>(line);
+			readConfig<double>(line, scope);
 			break;
 
 		case ConfigType::Float:
-			readConfig<float>(line);
+			readConfig<float>(line, scope);
 			break;
 
 		case ConfigType::Integer:
-			readConfig<ConfigInt>(line);
+			readConfig<ConfigInt>(line, scope);
 			break;
 
 		case ConfigType::String:
-			readConfig<string>(line);
+			readConfig<string>(line, scope);
 			break;
 		} // switch (type->second)
 	} // while (std::getline(file, line))
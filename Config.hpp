@@ -25,7 +25,8 @@ namespace Procon {
 		Config& operator=(const Config&) = delete;
 		Config& operator=(Config&&) = delete;
 
-		static void readConfigFile(const std::string& filename);
+		// Values from a file read with a scope are stored as scope + name
+		static void readConfigFile(const std::string& filename, const std::string& scope = "");
 
 		template<class T>
 		static std::optional<T> get(const std::string& name) {
@@ -36,6 +37,17 @@ namespace Procon {
 			return {};
 		}
 
+		// Looks in the scope first, then falls back to the unscoped value
+		template<class T>
+		static std::optional<T> get(const std::string& name, const std::string& scope) {
+			if (!scope.empty()) {
+				std::optional<T> scoped{ get<T>(scope + name) };
+				if (scoped)
+					return scoped;
+			}
+			return get<T>(name);
+		}
+
 		template<class T>
 		static void store(const std::string& name, const T& value) {
 			getStore<T>().insert({ name, value });
@@ -0,0 +1,123 @@
+#include "Consumer.hpp"
+
+#include <array>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "Config.hpp"
+#include "Controller.hpp"
+#include "Slots.hpp"
+#include "Stream.hpp"
+#include "XOutput.hpp"
+
+namespace {
+	using namespace Procon;
+	using clock = Controller::clock;
+
+	// A streamed controller and the virtual pad this process feeds from it
+	struct StreamedPad {
+		StreamReader reader;
+		Controller pad;
+		bool centered{ false };
+	};
+
+	// Decodes everything the reader published since the last pass. Returns
+	// false if there was nothing new.
+	bool consume(StreamedPad &s, std::ostream &out) {
+		bool consumed{ false };
+		while (const StreamEntry *entry = s.reader.next()) {
+			consumed = true;
+			clock::time_point received;
+			consumeEntry(s.reader, *entry, s.pad, received);
+		}
+		if (consumed && !s.centered) {
+			const ExpandedPadState state = s.pad.getState();
+			if (state.sharePressed) {
+				s.pad.setCalibrationCenter(state.leftStick, state.rightStick);
+				s.pad.removeStateReader();
+				s.centered = true;
+				out << "Set stick centers for controller LED " << s.pad.getPort() + 1 << '\n';
+			}
+		}
+		return consumed;
+	}
+};
+
+namespace Procon {
+
+	bool consumeEntry(StreamReader &reader, const StreamEntry &entry, Controller &pad, clock::time_point &received) {
+		// Copied out and checked before anything stateful sees it, a torn
+		// report would otherwise already be in the pipeline's history
+		std::array<uchar, streamReportLen> report;
+		std::memcpy(report.data(), entry.report.data(), report.size());
+		const uint32_t length{ entry.length };
+		received = clock::time_point{ clock::duration(entry.received) };
+		if (!reader.valid()) {
+			return false;
+		}
+		if (length == 0) {
+			// The reader lost the controller, nothing stays held until it's back
+			XINPUT_GAMEPAD neutral{};
+			XOutput::XOutputSetState(pad.getPort(), &neutral);
+			return true;
+		}
+		if (pad.decodeReport(report.data(), length, received)) {
+			pad.submitReport(report.data(), length, received);
+		}
+		return true;
+	}
+
+	int runConsumer(std::ostream &out, const bool &stop) {
+		try {
+			std::vector<StreamedPad> pads;
+			pads.reserve(maxSlots);
+			for (uchar port{ 0 }; port < maxSlots; ++port) {
+				std::optional<StreamReader> reader;
+				try {
+					reader.emplace(port);
+				}
+				catch (const std::runtime_error &) {
+					continue; // No controller in this slot, or a stream we can't read
+				}
+				// Anything the pad throws, like a config error, ends the consumer
+				pads.push_back({ std::move(*reader), Controller{ port } });
+				pads.back().pad.plugIn();
+				pads.back().pad.addStateReader(); // Until its stick centers are set
+			}
+			if (pads.empty()) {
+				out << "No controller streams found, start ProconXInput --reader first.\n";
+				return -1;
+			}
+			out << "Consuming " << pads.size() << " controller stream(s).\n";
+			out << "Press the Share button to set stick center.\n\n";
+
+			while (!stop) {
+				bool consumed{ false };
+				for (StreamedPad &s : pads) {
+					consumed = consume(s, out) || consumed;
+				}
+				if (!consumed) {
+					std::this_thread::yield();
+				}
+			}
+			for (const StreamedPad &s : pads) {
+				out << "Controller LED " << s.pad.getPort() + 1 << ": "
+					<< s.reader.skipped() << " reports skipped, "
+					<< s.pad.getInvalidReports() << " invalid reports dropped\n";
+			}
+		}
+		catch (ControllerException &e) {
+			out << "ControllerException: " << e.what() << '\n';
+			return -1;
+		}
+		catch (const ConfigError &e) {
+			out << "Error in config file: " << e.what() << '\n';
+			return -1;
+		}
+		return 0;
+	}
+
+};
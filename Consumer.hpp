@@ -0,0 +1,26 @@
+#pragma once
+
+#include <chrono>
+#include <ostream>
+
+namespace Procon {
+
+	class Controller;
+	class StreamReader;
+	struct StreamEntry;
+
+	// Consumer side of the reader/consumer split, run with --consumer.
+	// Picks up the report streams a --reader process publishes and runs
+	// each raw report through this process's own profiles, calibration and
+	// injection into a virtual pad, so only the reader needs access to the
+	// controllers. Runs until stop is set. Needs ScpVBus. Returns non-zero on
+	// failure.
+	int runConsumer(std::ostream &out, const bool &stop);
+
+	// What runConsumer() does with each entry reader.next() returns: copies
+	// it out of the ring, checks it, and feeds it to pad's virtual pad.
+	// Returns false, with nothing fed, if the entry was overwritten while
+	// being copied. received is when the reader got the report.
+	bool consumeEntry(StreamReader &reader, const StreamEntry &entry, Controller &pad, std::chrono::steady_clock::time_point &received);
+
+};
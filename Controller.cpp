@@ -2,19 +2,29 @@
 
 #include <array>
 #include <algorithm>
-#ifdef _DEBUG
-#include <iostream>
-#endif
 #include <string>
 #include <limits>
-#include <vector>
 
 #include "hidapi.h"
 #include "XOutput.hpp"
 #include "Config.hpp"
+#include "Profiles.hpp"
+#include "ReportView.hpp"
+#include "Slots.hpp"
+#include "Stream.hpp"
+#include "Usage.hpp"
 
 using namespace XOutput;
 
+namespace {
+	const std::string statusIntervalName{ "iStatusIntervalMs" };
+	const std::string rumbleName{ "bRumble" };
+	const std::string slotReserveName{ "iSlotReserveMs" };
+	const std::string usageStatsName{ "bUsageStats" };
+	constexpr int defaultStatusInterval{ 100 };
+	constexpr int defaultSlotReserve{ 30000 };
+};
+
 namespace Procon {
 	using std::array;
 
@@ -26,29 +36,74 @@ namespace Procon {
 		dat.rightCenter = dat.leftCenter;
 		dat.left.x.min = dat.leftCenter.x;
 		dat.left.x.max = dat.leftCenter.x;
+		dat.left.x.scale = 2.0f; // Any movement is full deflection until the range is known
 		dat.left.y = dat.left.x;
 		dat.right = dat.left;
+		dat.leftGate.maxRadiusSq.fill(0);
+		dat.leftGate.gain.fill(1.0f);
+		dat.leftGate.unfaded = 0.0f;
+		dat.rightGate = dat.leftGate;
 	}
 
 	void HIDCloser::operator()(hid_device *ptr) {
 		if (ptr != nullptr)
 			hid_close(ptr);
 	}
-	void zeroPadState(ExpandedPadState &state) {
-		state.xinState = { 0 };
-		state.leftStick = { 0 };
-		state.rightStick = { 0 };
-		state.sharePressed = false;
-	}
-	Controller::Controller(uchar port) :device(nullptr), port(port) {
+	// Settings and state only the status path touches, every iStatusIntervalMs
+	struct Controller::ColdState {
+		ColdState() :
+			statusInterval(std::max(1, Config::get<int32_t>(statusIntervalName).value_or(defaultStatusInterval))),
+			forwardRumble(Config::get<bool>(rumbleName).value_or(false)),
+			slotReserve(std::max(0, Config::get<int32_t>(slotReserveName).value_or(defaultSlotReserve))),
+			haptics(static_cast<unsigned int>(statusInterval.count()))
+		{}
+
+		std::chrono::milliseconds statusInterval;
+		bool forwardRumble; // Send the game's rumble to the controller
+		std::chrono::milliseconds slotReserve; // 0 holds the slot until exit
+		bool connected{ false };
+		bool slotClaimed{ false };
+		bool streaming{ false }; // --reader mode, there's no virtual pad
+		bool lost{ false };
+		clock::time_point lostAt{};
+		Haptics haptics;
+		ControllerIdentity identity{};
+		bool macRead{ false }; // identity.mac came from the device on the last open
+		bool released{ false }; // Lost past iSlotReserveMs, the pad is unplugged and it's no longer looked for
+		bool reattaching{ false }; // Opening a device that may be this controller
+		ControllerIdentity previous{}; // While reattaching, who the device has to turn out to be
+		std::string reattachPath; // The device being reattached
+		std::vector<std::string> rejected; // Paths of devices that turned out to be other controllers
+		CommandQueue commands;
+	};
+
+	Controller::Controller(uchar port, Clock &clock) :
+		device(nullptr),
+		clockSource(&clock),
+		watchdog(clock.now()),
+		idleDetector(clock.now()),
+		governor(clock.now()),
+		injection(port),
+		lastReport(clock.now()),
+		nextStatus(clock.now()),
+		port(port),
+		cold(std::make_unique<ColdState>())
+	{
 		SetDefaultCalibration(calib);
+		if (Config::get<bool>(usageStatsName).value_or(false)) {
+			usage = std::make_unique<UsageTracker>(clock.now());
+		}
+		statusUpdates = cold->forwardRumble || cold->haptics.enabled();
 	}
 	Controller::Controller(Controller &&) = default;
 	Controller& Controller::operator=(Controller &&) = default;
 	Controller::~Controller() {
-		if (_connected) {
+		if (cold && cold->connected) {
 			XOutputUnPlug(port);
 		}
+		if (cold && cold->slotClaimed) {
+			SlotTable::release(port);
+		}
 		if (device) {
 			static const array<uchar, 2> disconnect{ 0x80, 0x05 };
 			exchange(disconnect);
@@ -75,62 +130,76 @@ namespace {
 	constexpr uchar ledCommand{ 0x30 };
 	const array<uchar, 1> led{ 0x1 };
 
+	// Identity, in openSequence
+	constexpr uchar deviceInfoCommand{ 0x02 };
+	constexpr uchar spiReadCommand{ 0x10 };
+	// Body then button color, 3 bytes each, little endian address then length
+	const array<uchar, 5> colorsRead{ 0x50, 0x60, 0x00, 0x00, 0x06 };
+	constexpr size_t spiReadData{ Procon::subcommandReplyData + 5 };
+
+	// HID serial and path, the serial alone isn't unique for every adapter
+	std::string identityKey(const hid_device_info *dev) {
+		std::string key;
+		if (dev->serial_number != nullptr) {
+			for (const wchar_t *c = dev->serial_number; *c != L'\0'; ++c) {
+				key += static_cast<char>(*c);
+			}
+		}
+		key += '@';
+		key += dev->path;
+		return key;
+	}
+
+	uint32_t readColor(const uchar *data) {
+		return (static_cast<uint32_t>(data[0]) << 16) | (static_cast<uint32_t>(data[1]) << 8) | data[2];
+	}
+
+	// updateStatus
+	constexpr uchar rumbleOnly{ 0x10 };
+	constexpr uchar subcommand{ 0x01 };
+
 	// pollInput
 	constexpr uchar getInput{ 0x1f };
 	const array<uchar, 0> empty{};
+}; //namespace
+namespace Procon {
 
-	struct InputPacket {
-		uint8_t header[8];
-		uint8_t unknown[5];
-		uint8_t rightButtons;
-		uint8_t middleButtons;
-		uint8_t leftButtons;
-		uint8_t sticks[6];
-	};
-
-	constexpr double lerp(double min, double max, double t) {
-		return (1.0 - t) * min + t * max;
-	}
-
-	// stick is current stick location, range is min/max of stick, center is center point of stick
-	void calibrateToRange(const StickPoint &stick, const StickRange &range, const StickPoint &center, short &outx, short &outy) {
-		constexpr short smax = std::numeric_limits<short>::max();
-		constexpr short smin = std::numeric_limits<short>::min();
-		
-		outx = static_cast<short>(
-			smax * std::clamp(
-				(static_cast<double>(stick.x) - center.x) / static_cast<double>(range.x.max - range.x.min) * 2.0,
-				-1.0,
-				1.0
-			)
-			
-		);
-		outy = static_cast<short>(
-			smax *std::clamp(
-				(static_cast<double>(stick.y) - center.y) / static_cast<double>(range.y.max - range.y.min) * 2.0,
-				-1.0,
-				1.0
-			)
-		);
-
-	}
-
-	short expandUChar(uchar c) {
-		constexpr uchar ucmax = std::numeric_limits<uchar>::max();
-		constexpr short smax = std::numeric_limits<short>::max();
-		constexpr short smin = std::numeric_limits<short>::min();
+	void Controller::openDevice(hid_device_info *dev) {
+		attachDevice(dev);
+		finishOpen();
+	}
 
-		double d = std::clamp(static_cast<double>(c) / ucmax, 0.0, 1.0);
-		return static_cast<short>( lerp(smin, smax, d) );
+	void Controller::finishOpen() {
+		claimSlot();
+		try {
+			if (cold->streaming) {
+				stream = std::make_unique<StreamWriter>(port);
+			}
+			else {
+				plugIn();
+			}
+		}
+		catch (ControllerException &) {
+			device.reset(nullptr);
+			throw;
+		}
+		clockSource->sleepFor(std::chrono::milliseconds(100));
+		cold->haptics.trigger(HapticEvent::Connected);
 	}
 
-};
-namespace Procon {
+	void Controller::streamReports() {
+		cold->streaming = true;
+		stateReaders.add();
+	}
 
-	void Controller::openDevice(hid_device_info *dev) {
-		using namespace std::this_thread;
-		using namespace std::chrono;
+	void Controller::attachDevice(hid_device_info *dev) {
+		beginOpen(dev);
+		while (pumpCommands()) {
+			clockSource->yield();
+		}
+	}
 
+	void Controller::beginOpen(hid_device_info *dev) {
 		if (dev == nullptr)
 			throw ControllerException("Unable to open controller device: dev was nullptr.");
 		if (dev->product_id != Procon_ID)
@@ -140,387 +209,538 @@ namespace Procon {
 			throw ControllerException("Unable to open controller device: device path could not be opened.");
 		//vController.ProductId = dev->product_id;
 		//vController.VendorId = dev->vendor_id;
-		if (!exchange(handshake)) {
-			throw ControllerException("Handshake failed.");
+		cold->commands.start(openSequence(*cold, identityKey(dev)));
+		commandsBusy = true;
+	}
+
+	bool Controller::pumpCommands() {
+		const auto write = [this](const uchar *data, size_t length) {
+			return writeDevice(data, length);
+		};
+		const auto read = [this](uchar *buffer, size_t length) {
+			return readDevice(buffer, length, 0);
+		};
+		// Input that came in ahead of a subcommand reply still reaches the pad,
+		// once there's a pad or stream to send it to
+		const auto input = [this](const uchar *report, int length) {
+			if (length <= usbInputLayout.idOffset || report[usbInputLayout.idOffset] != usbInputLayout.reportId) {
+				return;
+			}
+			// Until its MAC matches, a device being reattached may be someone
+			// else's controller and mustn't touch this one's pad or state
+			const ColdState &c = *cold;
+			if (c.reattaching && (!c.macRead || c.identity.mac != c.previous.mac)) {
+				return;
+			}
+			if (cold->connected || stream) {
+				const clock::time_point now{ clockSource->now() };
+				watchdog.reportReceived(now);
+				processReport(report, static_cast<size_t>(length), now);
+			}
+		};
+		try {
+			commandsBusy = cold->commands.pump(clockSource->now(), std::chrono::milliseconds(watchdog.readTimeout()), write, read, input);
+		}
+		catch (...) {
+			commandsBusy = false;
+			throw;
 		}
-		exchange(switchBaudrate);
-		exchange(handshake);
-		exchange(HIDOnlyMode);
-		
-		
-		sendSubcommand(0x1, rumbleCommand, enable);
-		sendSubcommand(0x1, imuDataCommand, enable);
-		sendSubcommand(0x1, ledCommand, led);
+		return commandsBusy;
+	}
 
-		if (XOutputPlugIn(port) != ERROR_SUCCESS) {
-			device.reset(nullptr);
-			throw ControllerException("Unable to plugin XOutput controller.");
+	CommandTask Controller::openSequence(ColdState &c, std::string key) {
+		CommandQueue &q = c.commands;
+		const CommandReply hello{ co_await q.send(handshake) };
+		if (hello.length <= 0) {
+			throw ControllerException("Handshake failed.");
+		}
+		co_await q.send(switchBaudrate);
+		co_await q.send(handshake);
+		co_await q.send(HIDOnlyMode);
+
+		// Always asked, every Pro Controller has the same HID serial so only
+		// the MAC tells a different controller on the same port apart
+		ControllerIdentity &id = c.identity;
+		id = {};
+		id.key = key;
+		c.macRead = false;
+		const CommandReply info{ co_await q.send(usbCommand(subcommand, subcommandPacket(q.nextPacket(), deviceInfoCommand, empty)), deviceInfoCommand) };
+		if (info.length > subcommandReplyData) {
+			const uchar *data = info.data + subcommandReplyData;
+			id.firmwareMajor = data[0];
+			id.firmwareMinor = data[1];
+			std::copy(data + 4, data + 10, id.mac.begin());
+			c.macRead = true;
+			// Only the flash read is skipped for controllers seen before
+			if (!IdentityCache::findColors(id)) {
+				const CommandReply colors{ co_await q.send(usbCommand(subcommand, subcommandPacket(q.nextPacket(), spiReadCommand, colorsRead)), spiReadCommand) };
+				if (colors.length >= static_cast<int>(spiReadData + 6)) {
+					id.bodyColor = readColor(colors.data + spiReadData);
+					id.buttonColor = readColor(colors.data + spiReadData + 3);
+					IdentityCache::store(id);
+				}
+			}
 		}
-		_connected = true;
-		sleep_for(milliseconds(100));
-		//updateStatus();
+
+		co_await q.send(usbCommand(subcommand, subcommandPacket(q.nextPacket(), rumbleCommand, enable)), rumbleCommand);
+		co_await q.send(usbCommand(subcommand, subcommandPacket(q.nextPacket(), imuDataCommand, enable)), imuDataCommand);
+		co_await q.send(usbCommand(subcommand, subcommandPacket(q.nextPacket(), ledCommand, led)), ledCommand);
 	}
 
-};
-namespace {
-	using std::vector;
-	using std::tuple;
-	using std::array;
+	CommandTask Controller::rumbleSequence(ColdState &c, RumbleLevel level) {
+		CommandQueue &q = c.commands;
+		// Each motor gets its own packet
+		if (level.large != 0 || level.small != 0) {
+			co_await q.send(usbCommand(rumbleOnly, rumblePacket(q.nextPacket(), level.large, 0)));
+			co_await q.send(usbCommand(rumbleOnly, rumblePacket(q.nextPacket(), 0, level.small)));
+		}
+		else {
+			co_await q.send(usbCommand(rumbleOnly, rumblePacket(q.nextPacket(), 0, 0)));
+		}
+	}
 
-	using namespace Procon;
+	CommandTask Controller::ledSequence(ColdState &c, uchar led) {
+		CommandQueue &q = c.commands;
+		const array<uchar, 1> ledData{ static_cast<uchar>(0x1 << led) };
+		co_await q.send(usbCommand(subcommand, subcommandPacket(q.nextPacket(), ledCommand, ledData)), ledCommand);
+	}
 
-	const std::array<Button, 8> JoyconLBitmap =
-	{
-		Button::DPadDown,
-		Button::DPadUp,
-		Button::DPadRight,
-		Button::DPadLeft,
-		Button::None,
-		Button::None,
-		Button::L,
-		Button::LZ
-	};
+	int Controller::writeDevice(const uchar *data, size_t length) {
+		if (simulated != nullptr) {
+			simulated->write(data, length);
+			return static_cast<int>(length);
+		}
+		return device ? hid_write(device.get(), data, length) : -1;
+	}
 
-	const std::array<Button, 8> JoyconRBitmap = {
-		Button::Y,
-		Button::X,
-		Button::B,
-		Button::A,
-		Button::None,
-		Button::None,
-		Button::R,
-		Button::RZ
-	};
+	int Controller::readDevice(uchar *buffer, size_t length, int timeoutMs) {
+		if (simulated != nullptr) {
+			return simulated->read(buffer, length, timeoutMs);
+		}
+		return device ? hid_read_timeout(device.get(), buffer, length, timeoutMs) : -1;
+	}
 
-	const std::array<Button, 8> JoyconMidBitmap = {
-		Button::Minus,
-		Button::Plus,
-		Button::RStick,
-		Button::LStick,
-		Button::Home,
-		Button::Share,
-		Button::None,
-		Button::None
-	};
+	void Controller::startProbe(clock::time_point now) {
+		const auto poll = usbCommand(getInput, empty);
+		if (writeDevice(poll.data(), poll.size()) < 0) {
+			loseDevice();
+			return;
+		}
+		probePending = true;
+		probeDeadline = now + std::chrono::milliseconds(watchdog.readTimeout());
+	}
 
-	const array<Button, 8>& getButtonMap(ButtonSource s) {
-		switch (s) {
-		case ButtonSource::Left:
-			return JoyconLBitmap;
-		case ButtonSource::Middle:
-			return JoyconMidBitmap;
-		case ButtonSource::Right:
-			return JoyconRBitmap;
-		default:
-			throw std::logic_error("Unknown ButtonSource passed to getButtonMap");
-		}
-	}
-
-	void pullButtonsFromByte(uchar c, ButtonSource src, vector<tuple<Button, bool>> &out) {
-		const array<Button, 8>& map = getButtonMap(src);
-		for (uchar i{ 0 }; i < 8; ++i) {
-			if (map[i] == Button::None) continue;
-			out.push_back(std::make_tuple(map[i], (c & (1 << i)) != 0));
-		}
-	}
-
-	constexpr unsigned short buttonToReportBits(Button b){
-		switch (b) {
-		case Button::DPadUp:
-			return 0x0001;
-		case Button::DPadDown:
-			return 0x0002;
-		case Button::DPadLeft:
-			return 0x0004;
-		case Button::DPadRight:
-			return 0x0008;
-		case Button::Plus:
-			return 0x0010;
-		case Button::Minus:
-			return 0x0020;
-		case Button::LStick:
-			return 0x0040;
-		case Button::RStick:
-			return 0x0080;
-		case Button::L:
-			return 0x0100;
-		case Button::R:
-			return 0x0200;
-		case Button::Home:
-			return 0x0400; // Undocumented
-
-		// NOTICE: A and B are swapped, and X and Y are swapped.
-		case Button::A:
-			return 0x2000;
-		case Button::B:
-			return 0x1000;
-		case Button::X:
-			return 0x8000;
-		case Button::Y:
-			return 0x4000;
-		default:
-			return 0x0000;
-		}
-	}
-	constexpr unsigned short buttonToReportBitsOld(Button b) {
-		switch (b) {
-		case Button::DPadUp:
-			return 0x0001;
-		case Button::DPadDown:
-			return 0x0002;
-		case Button::DPadLeft:
-			return 0x0004;
-		case Button::DPadRight:
-			return 0x0008;
-		case Button::Plus:
-			return 0x0010;
-		case Button::Minus:
-			return 0x0020;
-		case Button::LStick:
-			return 0x0040;
-		case Button::RStick:
-			return 0x0080;
-		case Button::L:
-			return 0x0100;
-		case Button::R:
-			return 0x0200;
-		case Button::Home:
-			return 0x0400; // Undocumented
-
-		case Button::A:
-			return 0x1000;
-		case Button::B:
-			return 0x2000;
-		case Button::X:
-			return 0x4000;
-		case Button::Y:
-			return 0x8000;
-		default:
-			return 0x0000;
-		}
-	}
-
-	const std::string buttonConfigName{ "bMatchButtonLabels" };
-
-	void mapButtonToState(Button b, ExpandedPadState &state) {
-		switch (b) {
-		case Button::LZ:
-			state.xinState.bLeftTrigger = std::numeric_limits<BYTE>::max();
+	void Controller::readProbe(clock::time_point now) {
+		std::array<uchar, exchangeLen> reply;
+		const int length{ readDevice(reply.data(), reply.size(), 0) };
+		if (length < 0) {
+			loseDevice();
 			return;
-		case Button::RZ:
-			state.xinState.bRightTrigger = std::numeric_limits<BYTE>::max();
+		}
+		if (length == 0) {
+			if (now >= probeDeadline) {
+				probePending = false;
+				watchdog.reportMissed(now);
+			}
 			return;
-		case Button::Share:
-			state.sharePressed = true;
+		}
+		probePending = false;
+		watchdog.reportReceived(now);
+		processReport(reply.data(), static_cast<size_t>(length), now);
+	}
+
+	void Controller::submitInjection(clock::time_point now) {
+		if (!cold->connected || stream || simulated != nullptr) {
 			return;
-		default:
-			if (Config::get<bool>(buttonConfigName).value_or(false)) {
-				state.xinState.wButtons |= buttonToReportBitsOld(b);
-			}
-			else {
-				state.xinState.wButtons |= buttonToReportBits(b);
+		}
+		const bool wasInjecting{ injecting };
+		XINPUT_GAMEPAD pad{ 0 };
+		injecting = injection.merge(pad, now);
+		if (injecting || wasInjecting) {
+			XOutputSetState(port, &pad);
+		}
+	}
+
+	void Controller::claimSlot() {
+		const std::optional<uchar> slot{ SlotTable::claim(cold->identity) };
+		if (!slot) {
+			device.reset(nullptr);
+			throw ControllerException("Unable to open controller device: every player slot is taken.");
+		}
+		if (*slot != port) {
+			port = *slot;
+			injection = InjectionReader(port);
+		}
+		cold->slotClaimed = true;
+	}
+
+	bool Controller::reattach(hid_device_info *dev) {
+		ColdState &c = *cold;
+		if (!awaitingDevice() || dev == nullptr
+			|| std::find(c.rejected.begin(), c.rejected.end(), dev->path) != c.rejected.end()) {
+			return false;
+		}
+		c.previous = c.identity;
+		try {
+			beginOpen(dev);
+		}
+		catch (ControllerException &) {
+			device.reset(nullptr);
+			c.identity = c.previous;
+			return false;
+		}
+		c.reattaching = true;
+		c.reattachPath = dev->path;
+		return true;
+	}
+
+	void Controller::verifyReattach() {
+		ColdState &c = *cold;
+		try {
+			if (pumpCommands()) {
+				return;
 			}
+		}
+		catch (ControllerException &) {
+			// Didn't get through the handshake, a later scan tries it again
+			dropReattach();
+			return;
+		}
+		// Only a MAC the device just reported says it's the same controller
+		if (!c.macRead || c.identity.mac != c.previous.mac) {
+			c.rejected.push_back(c.reattachPath);
+			dropReattach();
 			return;
 		}
+		c.reattaching = false;
+		c.lost = false;
+		lastReport = clockSource->now();
+		c.haptics.trigger(HapticEvent::Connected);
 	}
 
-	void updateCalibrationRangeStick(const StickPoint &input, StickRange &cal) {
-		using std::max;
-		using std::min;
-
-		cal.x.max = max(cal.x.max, input.x);
-		cal.x.min = min(cal.x.min, input.x);
-		cal.y.max = max(cal.y.max, input.y);
-		cal.y.min = min(cal.y.min, input.y);
-		
-	}
-
-	void updateCalibrationRange(const ExpandedPadState &state, CalibrationData &cal) {
-		updateCalibrationRangeStick(state.leftStick, cal.left);
-		updateCalibrationRangeStick(state.rightStick, cal.right);
-	}
-
-#ifdef _DEBUG
-	using std::string;
-
-	const string buttonA{ "A" };
-	const string buttonB{ "B" };
-	const string buttonX{ "X" };
-	const string buttonY{ "Y" };
-	const string buttonLStick{ "Left Stick" };
-	const string buttonRStick{ "Right Stick" };
-	const string buttonL{ "L" };
-	const string buttonR{ "R" };
-	const string buttonLZ{ "LZ" };
-	const string buttonRZ{ "RZ" };
-	const string buttonHome{ "Home" };
-	const string buttonShare{ "Share" };
-	const string buttonPlus{ "Plus" };
-	const string buttonMinus{ "Minus" };
-	const string buttonDPUp{ "DPad Up" };
-	const string buttonDPLeft{ "DPad Left" };
-	const string buttonDPRight{ "DPad Right" };
-	const string buttonDPDown{ "DPad Down" };
-	const string buttonNone{ "None" };
-	const string buttonUnknown{ "Unknown" };
-
-	const std::string& buttonToString(Button b) {
-		switch (b) {
-		case Button::A:
-			return buttonA;
-		case Button::B:
-			return buttonB;
-		case Button::X:
-			return buttonX;
-		case Button::Y:
-			return buttonY;
-		case Button::LStick:
-			return buttonLStick;
-		case Button::RStick:
-			return buttonRStick;
-		case Button::L:
-			return buttonL;
-		case Button::LZ:
-			return buttonLZ;
-		case Button::R:
-			return buttonR;
-		case Button::RZ:
-			return buttonRZ;
-		case Button::Home:
-			return buttonHome;
-		case Button::Share:
-			return buttonShare;
-		case Button::Plus:
-			return buttonPlus;
-		case Button::Minus:
-			return buttonMinus;
-		case Button::DPadDown:
-			return buttonDPDown;
-		case Button::DPadUp:
-			return buttonDPUp;
-		case Button::DPadLeft:
-			return buttonDPLeft;
-		case Button::DPadRight:
-			return buttonDPRight;
-		case Button::None:
-			return buttonNone;
-		default:
-			return buttonUnknown;
-		}
-	}
-#endif //#ifdef _DEBUG
-
-	void mapInputToState(const InputPacket &p, CalibrationData &cal, ExpandedPadState &state) {
-		state.leftStick.x = ((p.sticks[1] & 0x0F) << 4) | ((p.sticks[0] & 0xF0) >> 4);
-		state.leftStick.y = p.sticks[2];
-		state.rightStick.x = ((p.sticks[4] & 0x0F) << 4) | ((p.sticks[3] & 0xF0) >> 4);
-		state.rightStick.y = p.sticks[5];
-		
-		updateCalibrationRange(state, cal);
-
-		// Sets state.xinState's sticks
-		calibrateToRange(state.leftStick, cal.left, cal.leftCenter, state.xinState.sThumbLX, state.xinState.sThumbLY);
-		calibrateToRange(state.rightStick, cal.right, cal.rightCenter, state.xinState.sThumbRX, state.xinState.sThumbRY);
-
-		vector<tuple<Button, bool>> buttons;
-		pullButtonsFromByte(p.leftButtons, ButtonSource::Left, buttons);
-		pullButtonsFromByte(p.rightButtons, ButtonSource::Right, buttons);
-		pullButtonsFromByte(p.middleButtons, ButtonSource::Middle, buttons);
-
-		for (auto pair : buttons) {
-			if (std::get<1>(pair)) {
-#ifdef _DEBUG
-				std::cout << buttonToString(std::get<0>(pair)) << ' ';
-#endif
-				mapButtonToState(std::get<0>(pair), state);
+	void Controller::dropReattach() {
+		ColdState &c = *cold;
+		device.reset(nullptr);
+		c.commands.clear();
+		commandsBusy = false;
+		c.identity = c.previous;
+		c.reattaching = false;
+	}
+
+	void Controller::forgetUnpluggedDevices(const hid_device_info *devs) {
+		std::vector<std::string> &rejected = cold->rejected;
+		const auto unplugged = [devs](const std::string &path) {
+			for (const hid_device_info *iter = devs; iter != nullptr; iter = iter->next) {
+				if (path == iter->path) {
+					return false;
+				}
 			}
+			return true;
+		};
+		rejected.erase(std::remove_if(rejected.begin(), rejected.end(), unplugged), rejected.end());
+	}
+
+	void Controller::loseDevice() {
+		device.reset(nullptr);
+		cold->commands.clear();
+		commandsBusy = false;
+		probePending = false;
+		governor.reset();
+		cold->lost = true;
+		cold->lostAt = clockSource->now();
+		// Nothing stays held while the controller is gone, the pad itself stays plugged in
+		padStatus.xinState = { 0 };
+		if (cold->connected) {
+			XOutputSetState(port, &padStatus.xinState);
+		}
+		if (stream) {
+			stream->publish(nullptr, 0, cold->lostAt, padStatus);
 		}
 	}
 
-	unsigned char operator ""_uc(unsigned long long t) {
-		return static_cast<unsigned char>(t);
+	void Controller::expireReservation() {
+		ColdState &c = *cold;
+		if (!c.connected || c.slotReserve.count() == 0 || clockSource->now() - c.lostAt < c.slotReserve) {
+			return;
+		}
+		XOutputUnPlug(port);
+		c.connected = false;
+		SlotTable::release(port);
+		c.slotClaimed = false;
+		c.released = true;
 	}
-}; //namespace
 
-namespace Procon {
+	void Controller::plugIn() {
+		if (XOutputPlugIn(port) != ERROR_SUCCESS) {
+			throw ControllerException("Unable to plugin XOutput controller.");
+		}
+		cold->connected = true;
+	}
+
+	void Controller::attachSimulatedDevice(SimulatedDevice &device) {
+		simulated = &device;
+	}
 
 	void Controller::pollInput() {
-		if (!device)
+		if (!device && simulated == nullptr) {
+			if (cold && cold->lost) {
+				expireReservation();
+				submitInjection(clockSource->now());
+			}
+			return;
+		}
+		// Command replies would be read as input, let the sequence finish
+		// first. Input reports it reads meanwhile are still processed.
+		if (commandsBusy) {
+			if (cold->reattaching) {
+				verifyReattach();
+			}
+			else {
+				pumpCommands();
+			}
+			return;
+		}
+		const clock::time_point now{ clockSource->now() };
+		if (probePending) {
+			readProbe(now);
+			return;
+		}
+		if (!watchdog.shouldPoll(now)) {
+			submitInjection(now);
+			return;
+		}
+		// Injected input is polled at full rate, so it's applied and released on time
+		if (!idleDetector.shouldPoll(now) && !injection.pending()) {
+			// Rumble and effects still play on an idle controller
+			if (statusUpdates) {
+				updateStatus();
+			}
 			return;
+		}
 
+		governor.inputPoll(now);
+		if (!watchdog.answering()) {
+			// It already let one read time out, don't wait on it again
+			startProbe(now);
+			return;
+		}
 		auto dat = sendCommand(getInput, empty);
 		if (!dat) {
-			throw ControllerException("Error sending getInput command.");
-		}
-		if (dat.value()[0] != 0x30) {
-			InputPacket p;
-			memcpy(&p, dat.value().data(), sizeof(InputPacket));
-
-			zeroPadState(padStatus);
-			mapInputToState(p, calib, padStatus);
-			
-			DWORD err;
-			if ((err = XOutputSetState(port, &padStatus.xinState)) != ERROR_SUCCESS) {
-				std::string errMsg{ "XOutput Error: " };
-				errMsg += std::to_string(err);
-				throw ControllerException(errMsg);
+			// Unplugged or gone, keep the slot for it to come back to
+			loseDevice();
+			return;
+		}
+		if (lastReadLength <= 0) {
+			// Timed out or failed, don't decode the zeroed buffer
+			watchdog.reportMissed(clockSource->now());
+			return;
+		}
+		watchdog.reportReceived(now);
+		processReport(dat.value().data(), static_cast<size_t>(lastReadLength), now);
+	}
+
+	bool Controller::decodeReport(const uchar *report, size_t length, clock::time_point received) {
+		// Truncated or corrupted reads would decode as garbage input, never submit them
+		if (!validateReport(report, length)) {
+			++invalidReports;
+			return false;
+		}
+		// Cap the step so a long gap (idle, stall) doesn't turn into one huge jump
+		const float elapsed{ std::min(0.1f, std::chrono::duration<float>(received - lastReport).count()) };
+		lastReport = received;
+		const Profile &profile = Profiles::active();
+		if (&profile != lastProfile) {
+			if (lastProfile != nullptr) {
+				cold->haptics.trigger(HapticEvent::ProfileSwitch);
 			}
+			// A turn left over from the old profile's flick stick would play out later
+			processing.flick = {};
+			lastProfile = &profile;
+		}
+		ReportView view{ report };
+		Frame frame{ view, elapsed, profile, calib, processing, padStatus };
+
+		// Stages only produce xinState and sharePressed, the raw fields are
+		// only unpacked for readers of getState()
+		padStatus.xinState = { 0 };
+		profile.process(frame);
+		if (stateReaders.any()) {
+			view.expand(padStatus);
+			publishedState.store(padStatus);
+		}
+		idleDetector.update(padStatus, view, clockSource->now());
+		if (usage) {
+			usage->update(padStatus.xinState, view, received);
+		}
+		const uchar battery{ view.battery() };
+		if (battery != lastBattery) {
+			lastBattery = battery;
+			cold->haptics.setBattery(battery & 0xE, (battery & 0x1) != 0);
+		}
+		return true;
+	}
+
+	void Controller::processReport(const uchar *report, size_t length, clock::time_point received) {
+		if (decodeReport(report, length, received)) {
+			submitReport(report, length, received);
+		}
+		if (statusUpdates) {
+			updateStatus();
+		}
+	}
+
+	void Controller::submitReport(const uchar *report, size_t length, clock::time_point received) {
+		if (simulated != nullptr) {
+			return;
+		}
+		if (stream) {
+			// Consumers merge their own injected input
+			stream->publish(report, length, received, padStatus);
+			return;
+		}
+		injecting = injection.merge(padStatus.xinState, received);
+		if (injecting) {
+			idleDetector.markActive(received);
+		}
+		DWORD err;
+		if ((err = XOutputSetState(port, &padStatus.xinState)) != ERROR_SUCCESS) {
+			std::string errMsg{ "XOutput Error: " };
+			errMsg += std::to_string(err);
+			throw ControllerException(errMsg);
 		}
-		//updateStatus();
 	}
 
 	bool Controller::connected() const {
-		return _connected;
+		return cold && cold->connected;
+	}
+	bool Controller::lost() const {
+		return cold && cold->lost;
+	}
+	bool Controller::awaitingDevice() const {
+		return cold && cold->lost && !cold->released && !cold->reattaching;
+	}
+	bool Controller::reattaching() const {
+		return cold && cold->reattaching;
+	}
+	bool Controller::idle() const {
+		return idleDetector.idle();
+	}
+	IdleStats Controller::getIdleStats() const {
+		return idleDetector.stats(clockSource->now());
+	}
+	bool Controller::stalled() const {
+		return watchdog.stalled();
+	}
+	WatchdogStats Controller::getWatchdogStats() const {
+		return watchdog.stats();
+	}
+	OutputStats Controller::getOutputStats() const {
+		return governor.stats();
+	}
+	size_t Controller::getInvalidReports() const {
+		return invalidReports;
+	}
+	const UsageTracker* Controller::getUsage() const {
+		return usage.get();
 	}
 	uchar Controller::getPort() const {
 		return port;
 	}
-	const ExpandedPadState& Controller::getState() const {
-		return padStatus;
+	const ControllerIdentity& Controller::getIdentity() const {
+		static const ControllerIdentity none{};
+		return cold ? cold->identity : none;
+	}
+	ExpandedPadState Controller::getState() const {
+		return publishedState.load();
+	}
+	void Controller::addStateReader() {
+		stateReaders.add();
+	}
+	void Controller::removeStateReader() {
+		stateReaders.remove();
 	}
 	void Controller::setCalibrationCenter(const StickPoint &left, const StickPoint &right) {
 		calib.leftCenter = left;
 		calib.rightCenter = right;
 	}
 	void Controller::updateStatus() {
-		if (clock::now() < lastStatus + std::chrono::milliseconds(100)) {
+		ColdState &c = *cold;
+		const clock::time_point now{ clockSource->now() };
+		if (now >= nextStatus) {
+			uchar vibrate{ 0 };
+			uchar led{ 0 };
+			uchar smallMotor{ 0 };
+			uchar bigMotor{ 0 };
+			// Streamed controllers have no virtual pad to ask
+			if (simulated == nullptr && c.connected) {
+				XOutputGetState(port, &vibrate, &bigMotor, &smallMotor, &led);
+			}
+			if (vibrate == 0 || !c.forwardRumble) {
+				bigMotor = 0;
+				smallMotor = 0;
+			}
+			// Haptic effects are mixed in by max amplitude, never as extra reports
+			const RumbleLevel effect{ c.haptics.tick() };
+			governor.offerRumble({ std::max(bigMotor, effect.large), std::max(smallMotor, effect.small) });
+			governor.offerLed(led);
+			nextStatus = now + c.statusInterval;
+		}
+		// At most one update between input polls, and only when the governor has room for it
+		if (commandsBusy) {
 			return;
 		}
-		uchar vibrate{ 0 };
-		uchar led{ 0 };
-		uchar smallMotor{ 0 };
-		uchar bigMotor{ 0 };
-		XOutputGetState(port, &vibrate, &bigMotor, &smallMotor, &led);
-		if (vibrate != 0) {
-			sendRumble(bigMotor, 0);
-			sendRumble(0, smallMotor);
-		}
-		array<uchar, 1> ledData{ static_cast<uchar>(0x1 << led) };
-		sendSubcommand(0x1, ledCommand, ledData);
-		lastStatus = clock::now();
-	}
-
-	Controller::exchangeArray Controller::sendRumble(uchar largeMotor, uchar smallMotor){
-		std::array<uchar, 9> buf{
-			static_cast<uchar>(rumbleCounter++ & 0xF),
-			0x80_uc,
-			0x00_uc,
-			0x40_uc,
-			0x40_uc,
-			0x80_uc,
-			0x00_uc,
-			0x40_uc,
-			0x40_uc
-		};
-		if (largeMotor != 0) {
-			buf[1] = buf[5] = 0x08;
-			buf[2] = buf[6] = largeMotor;
+		switch (governor.next(now)) {
+		case OutputKind::Rumble:
+			c.commands.start(rumbleSequence(c, governor.rumble()));
+			break;
+		case OutputKind::Led:
+			c.commands.start(ledSequence(c, governor.led()));
+			break;
+		case OutputKind::None:
+			return;
 		}
-		else if (smallMotor != 0) {
-			buf[1] = buf[5] = 0x10;
-			buf[2] = buf[6] = smallMotor;
+		commandsBusy = true;
+	}
+
+	void pollControllers(std::vector<Controller> &controllers, Clock &clock) {
+		bool allIdle{ true };
+		for (Controller &c : controllers) {
+			c.pollInput();
+			allIdle = allIdle && (c.idle() || c.stalled());
+		}
+		if (allIdle) {
+			// Idle controllers are only polled every iIdlePollIntervalMs, no need to spin
+			clock.sleepFor(std::chrono::milliseconds(1));
+		}
+		else {
+			clock.yield(); // sleep_for causes big lag and not yielding eats way more processor
+		}
+	}
+
+	void reattachControllers(std::vector<Controller> &controllers) {
+		hid_device_info * const devs = hid_enumerate(NintendoID, Procon_ID);
+		for (Controller &c : controllers) {
+			c.forgetUnpluggedDevices(devs);
+		}
+		for (hid_device_info *iter = devs; iter != nullptr; iter = iter->next) {
+			if (iter->product_id != Procon_ID) {
+				continue;
+			}
+			// Opening a device another controller is using or trying would reset it
+			const std::string key{ identityKey(iter) };
+			const bool inUse{ std::any_of(controllers.begin(), controllers.end(), [&key](const Controller &c) {
+				return (!c.lost() || c.reattaching()) && c.getIdentity().key == key;
+			}) };
+			if (inUse) {
+				continue;
+			}
+			for (Controller &c : controllers) {
+				if (c.reattach(iter)) {
+					break;
+				}
+			}
 		}
-		return sendCommand(0x10, buf);
+		hid_free_enumeration(devs);
 	}
 
 	ControllerException::ControllerException(const std::string& what) : runtime_error(what) {}
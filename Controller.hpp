@@ -1,10 +1,14 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <memory>
 #include <optional>
 #include <stdexcept>
+#include <string>
 #include <chrono>
 #include <thread>
+#include <vector>
 
 #ifndef NOMINMAX
 #define NOMINMAX
@@ -12,15 +16,28 @@
 #include <Windows.h>
 #include <Xinput.h>
 
+#include "Clock.hpp"
+#include "Commands.hpp"
 #include "Common.hpp"
+#include "Governor.hpp"
+#include "Haptics.hpp"
+#include "Identity.hpp"
+#include "IdleDetector.hpp"
+#include "Injection.hpp"
+#include "Pipeline.hpp"
+#include "SeqLock.hpp"
+#include "Watchdog.hpp"
 #include "hidapi.h"
 
 namespace Procon {
 
-	constexpr size_t exchangeLen{ 0x400 };
+	class UsageTracker;
+	class StreamWriter;
+
 	struct AxisRange {
 		uchar min;
 		uchar max;
+		float scale; // 2 / (max - min), only recomputed when the range moves
 	};
 	struct StickRange {
 		AxisRange x;
@@ -30,52 +47,196 @@ namespace Procon {
 		uchar x;
 		uchar y;
 	};
+	// Learned shape of a stick's physical gate.
+	// maxRadiusSq is the furthest calibrated distance (squared) seen in each
+	// angular sector, gain is what scales that distance to full deflection.
+	constexpr size_t gateSectors{ 64 };
+	struct GateShape {
+		std::array<int, gateSectors> maxRadiusSq;
+		std::array<float, gateSectors> gain;
+		float unfaded; // Seconds of fading not yet applied to maxRadiusSq
+	};
 	struct CalibrationData {
 		StickRange left;
 		StickRange right;
 		StickPoint leftCenter;
 		StickPoint rightCenter;
+		GateShape leftGate;
+		GateShape rightGate;
 	};
 	void SetDefaultCalibration(CalibrationData &dat);
+	// Number of registered getState() readers, counted from any thread.
+	// Copying is only valid while no other thread touches either object.
+	class ReaderCount {
+		std::atomic<unsigned int> count{ 0 };
+	public:
+		ReaderCount() = default;
+		ReaderCount(const ReaderCount &other) : count{ other.count.load() } {}
+		ReaderCount& operator=(const ReaderCount &other) {
+			count.store(other.count.load());
+			return *this;
+		}
+		void add() {
+			count.fetch_add(1, std::memory_order_relaxed);
+		}
+		void remove() {
+			count.fetch_sub(1, std::memory_order_relaxed);
+		}
+		bool any() const {
+			return count.load(std::memory_order_relaxed) != 0;
+		}
+	};
 	struct HIDCloser {
 		void operator()(hid_device *ptr);
 	};
+	// Raw IMU values, the Procon sends three samples 5ms apart in every report
+	struct MotionSample {
+		short accel[3];
+		short gyro[3];
+	};
 	struct ExpandedPadState {
 		XINPUT_GAMEPAD xinState;
 		StickPoint leftStick;
 		StickPoint rightStick;
 		bool sharePressed;
+		MotionSample motion[3];
+		uchar battery; // Level 0 to 8 in the upper bits, lowest bit set while charging
+	};
+	// Stands in for the HID device in simulations, see attachSimulatedDevice()
+	class SimulatedDevice {
+	public:
+		virtual ~SimulatedDevice() = default;
+		virtual void write(const uchar *data, size_t length) = 0;
+		// Same contract as hid_read_timeout: bytes read, 0 on timeout, -1 on error
+		virtual int read(uchar *buffer, size_t length, int timeoutMs) = 0;
 	};
-	void zeroPadState(ExpandedPadState &state);
+
+	constexpr size_t cacheLine{ 64 };
+	// Controllers sit next to each other in a vector, none of them starts on a line another ends on
+	constexpr size_t controllerAlign{ cacheLine };
 	// Switch Procon class.
-	// Create, then call openDevice(hid_device_info) to initialize.
+	// Create, then call openDevice(hid_device_info) to initialize. The
+	// controller's player slot comes from SlotTable, not the constructor.
 	// Call pollInput() to send input to ViGEm, such as in a main loop.
 	// Cleanup is automatic when the object is destroyed.
 	// Throws Procon::Controller exceptions from openDevice.
-	class Controller {
-		bool _connected;
-		std::unique_ptr<hid_device, HIDCloser> device;
-		uchar rumbleCounter{ 0 };
+	// pollInput() must only be called from one thread, getState() is safe from any thread.
+	// A moved-from Controller may only be destroyed, assigned to, or asked
+	// connected(), lost() and getIdentity(), which answer as if it never opened.
+	class alignas(controllerAlign) Controller {
+	public:
 		using clock = std::chrono::steady_clock;
-		clock::time_point lastStatus{ clock::now() };
+	private:
+		struct ColdState;
+
+		// Hot, used on every poll, only touched by the polling thread
+		std::unique_ptr<hid_device, HIDCloser> device;
+		SimulatedDevice *simulated{ nullptr }; // Used instead of device when set
+		Clock *clockSource;
+		StallWatchdog watchdog;
+		IdleDetector idleDetector;
+		OutputGovernor governor;
+		InjectionReader injection;
+		std::unique_ptr<UsageTracker> usage; // Only with bUsageStats
+		std::unique_ptr<StreamWriter> stream; // Only in --reader mode, takes the virtual pad's place
+		clock::time_point lastReport;
+		clock::time_point nextStatus;
+		const Profile *lastProfile{ nullptr }; // Profile used for the previous report
+		int lastReadLength{ 0 }; // Bytes read by the last exchange, 0 on timeout, -1 on error
+		size_t invalidReports{ 0 }; // Replies dropped by validateReport()
 		uchar port{ 0 };
-		ExpandedPadState padStatus{};
+		uchar lastBattery{ 0xFF }; // Haptics only hear about battery changes
+		bool statusUpdates; // Rumble or haptics need updateStatus() to run
+		bool commandsBusy{ false }; // A command sequence is running, input polls wait for it
+		bool probePending{ false }; // A probe was sent to a controller that isn't answering
+		bool injecting{ false }; // The pad's last state had injected input merged in
+		clock::time_point probeDeadline; // Its reply counts as missed after this
+		ExpandedPadState padStatus{}; // Working copy
+		ProcessingState processing{};
 		CalibrationData calib;
+
+		// Cold, settings and the status path, out of line
+		std::unique_ptr<ColdState> cold;
+
+		// Last complete state, readable from any thread, on its own lines so
+		// readers don't pull the hot block away from the polling thread
+		alignas(controllerAlign) SeqLock<ExpandedPadState> publishedState;
+		ReaderCount stateReaders; // publishedState is only kept up to date while this isn't 0
 	public:
-		Controller(uchar port);
+		Controller(uchar port, Clock &clock = Clock::steady());
 		Controller(Controller &&);
 		Controller(const Controller&) = delete;
 		Controller& operator=(const Controller&) = delete;
 		Controller& operator=(Controller &&);
 		~Controller();
 
+		// beginOpen(), pumpCommands() until it returns false, then finishOpen()
 		void openDevice(hid_device_info *dev);
+		// Opens dev and queues its setup, so several controllers can be set
+		// up at once by pumping them in turn
+		void beginOpen(hid_device_info *dev);
+		// Claims a player slot and plugs in the virtual pad once setup is done
+		void finishOpen();
+		// Publishes reports to a report stream for --consumer processes
+		// instead of plugging in a virtual pad. Call before finishOpen(). The
+		// stream carries the full state, so it stays a state reader.
+		void streamReports();
+		// Advances queued command sequences without blocking, returns true
+		// while any are left. Rethrows what a sequence threw.
+		bool pumpCommands();
 		void pollInput();
+		// Starts reconnecting a lost controller to dev without unplugging its
+		// virtual pad. pollInput() runs the setup and drops dev again if it
+		// turns out to be another controller, that dev is then skipped until
+		// it's unplugged. Returns false, with nothing changed, if the
+		// controller isn't waiting for a device or dev was ruled out before.
+		bool reattach(hid_device_info *dev);
+		// Forgets the devices reattach() ruled out that aren't in devs anymore
+		void forgetUnpluggedDevices(const hid_device_info *devs);
+
+		// Plugs in the virtual controller without a device, for simulated
+		// controllers. openDevice() does this itself.
+		void plugIn();
+		// Talks to device instead of a real controller, and skips XOutput. Use
+		// with a VirtualClock to simulate a controller faster than real time.
+		void attachSimulatedDevice(SimulatedDevice &device);
+		// Runs a USB reply of length bytes through the pipeline and sends the
+		// result to XOutput, as pollInput() does after reading
+		void processReport(const uchar *report, size_t length, clock::time_point received);
+		// Only the pipeline part of processReport(), returns false if the reply
+		// wasn't a valid input report and was dropped
+		bool decodeReport(const uchar *report, size_t length, clock::time_point received);
+		// The rest of processReport(): sends what decodeReport() produced to
+		// XOutput, or to the report stream
+		void submitReport(const uchar *report, size_t length, clock::time_point received);
 
 		bool connected() const;
+		// The device went away, its slot is held for iSlotReserveMs
+		bool lost() const;
+		// Lost, and still holds its slot, so reattach() would take a device
+		bool awaitingDevice() const;
+		// Setting up a device reattach() was given
+		bool reattaching() const;
+		bool idle() const;
+		IdleStats getIdleStats() const;
+		bool stalled() const;
+		WatchdogStats getWatchdogStats() const;
+		OutputStats getOutputStats() const;
+		size_t getInvalidReports() const;
+		// Null unless bUsageStats is on
+		const UsageTracker* getUsage() const;
 		uchar getPort() const;
-		const ExpandedPadState& getState() const;
+		// Consistent snapshot of the last state sent to XOutput. Only updated
+		// while at least one state reader is registered.
+		ExpandedPadState getState() const;
+		// Registers a getState() reader, undo with removeStateReader() once
+		// done. With none registered the full ExpandedPadState is never
+		// unpacked. Safe from any thread.
+		void addStateReader();
+		void removeStateReader();
 		void setCalibrationCenter(const StickPoint &left, const StickPoint &right);
+		// MAC, firmware and colors, valid after openDevice()
+		const ControllerIdentity& getIdentity() const;
 	private:
 
 		void updateStatus();
@@ -84,6 +245,12 @@ namespace Procon {
 
 		template<size_t len>
 		exchangeArray exchange(std::array<uchar, len> const &data) {
+			if (simulated != nullptr) {
+				simulated->write(data.data(), len);
+				std::array<uchar, exchangeLen> ret{};
+				lastReadLength = simulated->read(ret.data(), exchangeLen, watchdog.readTimeout());
+				return ret;
+			}
 			if (!device) return {};
 
 			if (hid_write(device.get(), data.data(), len) < 0) {
@@ -91,51 +258,51 @@ namespace Procon {
 			}
 			std::array<uchar, exchangeLen> ret;
 			ret.fill(0);
-			hid_read(device.get(), ret.data(), exchangeLen);
+			lastReadLength = hid_read_timeout(device.get(), ret.data(), exchangeLen, watchdog.readTimeout());
 			return ret;
 		}
 
 		template<size_t len>
 		exchangeArray sendCommand(uchar command, std::array<uchar, len> const &data) {
-			std::array<uchar, len + 0x9> buf;
-			buf.fill(0);
-			buf[0x0] = 0x80;
-			buf[0x1] = 0x92;
-			buf[0x3] = 0x31;
-			buf[0x8] = command;
-			if (len > 0) {
-				memcpy(buf.data() + 0x9, data.data(), len);
-			}
-			return exchange(buf);
+			return exchange(usbCommand(command, data));
 		}
 
+		// Plain device I/O, to the simulated device if attached. -1 without a device
+		int writeDevice(const uchar *data, size_t length);
+		int readDevice(uchar *buffer, size_t length, int timeoutMs);
+		// Polls a controller that isn't answering without waiting for the reply,
+		// readProbe() picks it up on later passes
+		void startProbe(clock::time_point now);
+		void readProbe(clock::time_point now);
+		// Sends injected input over a centered pad while there are no reports
+		// to merge it into, and releases it once it ends
+		void submitInjection(clock::time_point now);
 
-		template<size_t len>
-		exchangeArray sendSubcommand(uchar command, uchar subcommand, std::array<uchar, len> const& data) {
-			std::array<uchar, 10 + len> buf
-			{ 
-				static_cast<uchar>(rumbleCounter++ & 0xF),
-				0x00_uc,
-				0x01_uc,
-				0x40_uc,
-				0x40_uc,
-				0x00_uc,
-				0x01_uc,
-				0x40_uc,
-				0x40_uc,
-				subcommand
-			};
-			if (len > 0) {
-				memcpy(buf.data() + 10, data.data(), len);
-			}
-			return sendCommand(command, buf);
-		}
-
-
-		exchangeArray sendRumble(uchar largeMotor, uchar smallMotor);
+		// Opens and initializes dev, without touching the virtual pad
+		void attachDevice(hid_device_info *dev);
+		void claimSlot();
+		void loseDevice();
+		// Unplugs the virtual pad once a lost controller's reservation runs out
+		void expireReservation();
+		// Pumps the setup of the device reattach() was given, and takes or
+		// drops it once the MAC is known
+		void verifyReattach();
+		void dropReattach();
 
+		// Command sequences, run by cold->commands. Static so a sequence
+		// doesn't hold on to a Controller that may be moved.
+		// Handshake, identity, then rumble, IMU and LED on
+		static CommandTask openSequence(ColdState &c, std::string identityKey);
+		static CommandTask rumbleSequence(ColdState &c, RumbleLevel level);
+		static CommandTask ledSequence(ColdState &c, uchar led);
 	};
 
+	// One pass of the main loop: polls every controller, then waits the way
+	// the loop should before the next pass
+	void pollControllers(std::vector<Controller> &controllers, Clock &clock);
+	// Looks for lost controllers among the connected devices and reattaches them
+	void reattachControllers(std::vector<Controller> &controllers);
+
 	class ControllerException : public std::runtime_error {
 	public:
 		explicit ControllerException(const std::string& what);
@@ -0,0 +1,138 @@
+#include "Governor.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include "Config.hpp"
+
+namespace {
+	const std::string reportRateName{ "iOutputReportRate" };
+	const std::string burstName{ "iOutputBurst" };
+
+	constexpr int defaultReportRate{ 250 };
+	constexpr int defaultBurst{ 4 };
+	// Part of the rate only feedback can use, so polling as fast as the rate
+	// allows can't starve rumble and LED updates
+	constexpr float feedbackShare{ 0.25f };
+	constexpr float reserveCap{ 2.0f }; // One rumble update, the most feedback sends at once
+
+	// Each motor gets its own packet, silence is one packet for both
+	float rumbleCost(Procon::RumbleLevel level) {
+		return level.large != 0 || level.small != 0 ? 2.0f : 1.0f;
+	}
+};
+
+namespace Procon {
+
+	OutputGovernor::OutputGovernor(clock::time_point start) :lastRefill(start) {
+		ratePerMs = std::max(1, Config::get<int32_t>(reportRateName).value_or(defaultReportRate)) / 1000.0f;
+		// A rumble update is two packets, it has to fit
+		burst = static_cast<float>(std::max(2, Config::get<int32_t>(burstName).value_or(defaultBurst)));
+		tokens = burst - reserveCap;
+		reserved = reserveCap;
+	}
+
+	void OutputGovernor::inputPoll(clock::time_point now) {
+		refill(now);
+		tokens = std::max(0.0f, tokens - 1.0f);
+		++totals.inputPolls;
+	}
+
+	void OutputGovernor::offerRumble(RumbleLevel level) {
+		if (rumblePending) {
+			++totals.dropped;
+		}
+		const bool silent{ level.large == 0 && level.small == 0 };
+		// Silence only needs sending once
+		rumblePending = !silent || rumbleActive;
+		pendingRumble = level;
+		rumbleWaiting = false;
+	}
+
+	void OutputGovernor::offerLed(uchar led) {
+		ledPending = led != sentLed;
+		ledWaiting = ledWaiting && ledPending;
+		pendingLed = led;
+	}
+
+	OutputKind OutputGovernor::next(clock::time_point now) {
+		refill(now);
+		if (rumblePending) {
+			const bool stop{ pendingRumble.large == 0 && pendingRumble.small == 0 };
+			// Motors left running are worse than going over budget, stopping never waits
+			if (stop) {
+				takeAvailable(rumbleCost(pendingRumble));
+				rumbleWaiting = false;
+			}
+			else if (!take(rumbleCost(pendingRumble), rumbleWaiting)) {
+				return OutputKind::None; // The LED doesn't get to jump ahead
+			}
+			rumblePending = false;
+			rumbleActive = pendingRumble.large != 0 || pendingRumble.small != 0;
+			totals.rumbleReports += static_cast<size_t>(rumbleCost(pendingRumble));
+			return OutputKind::Rumble;
+		}
+		if (ledPending) {
+			if (!take(1.0f, ledWaiting)) {
+				return OutputKind::None;
+			}
+			ledPending = false;
+			sentLed = pendingLed;
+			++totals.ledReports;
+			return OutputKind::Led;
+		}
+		return OutputKind::None;
+	}
+
+	RumbleLevel OutputGovernor::rumble() const {
+		return pendingRumble;
+	}
+
+	uchar OutputGovernor::led() const {
+		return pendingLed;
+	}
+
+	void OutputGovernor::reset() {
+		rumblePending = false;
+		rumbleWaiting = false;
+		rumbleActive = false;
+		ledPending = false;
+		ledWaiting = false;
+		sentLed = 0xFF;
+	}
+
+	OutputStats OutputGovernor::stats() const {
+		return totals;
+	}
+
+	void OutputGovernor::refill(clock::time_point now) {
+		const float elapsedMs{ std::chrono::duration<float, std::milli>(now - lastRefill).count() };
+		if (elapsedMs > 0.0f) {
+			tokens = std::min(burst - reserveCap, tokens + elapsedMs * ratePerMs * (1.0f - feedbackShare));
+			reserved = std::min(reserveCap, reserved + elapsedMs * ratePerMs * feedbackShare);
+			lastRefill = now;
+		}
+	}
+
+	bool OutputGovernor::take(float cost, bool &waiting) {
+		if (tokens + reserved < cost) {
+			if (!waiting) {
+				++totals.deferred;
+				waiting = true;
+			}
+			return false;
+		}
+		takeAvailable(cost);
+		waiting = false;
+		return true;
+	}
+
+	void OutputGovernor::takeAvailable(float cost) {
+		// Shared tokens first, the reserve is what input polls can't get at
+		const float shared{ std::min(tokens, cost) };
+		tokens -= shared;
+		reserved = std::max(0.0f, reserved - (cost - shared));
+	}
+
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+
+#include "Common.hpp"
+#include "Haptics.hpp"
+
+namespace Procon {
+
+	struct OutputStats {
+		size_t inputPolls{ 0 }; // Input polls charged to the bucket, never held back by it
+		size_t rumbleReports{ 0 }; // Rumble packets sent
+		size_t ledReports{ 0 }; // LED subcommands sent
+		size_t deferred{ 0 }; // Rumble or LED updates that had to wait for a token
+		size_t dropped{ 0 }; // Rumble updates replaced by a newer one before they were sent
+	};
+
+	enum class OutputKind : uchar {
+		None,
+		Rumble,
+		Led
+	};
+
+	// Per-controller output report budget.
+	// A token bucket of iOutputBurst reports, refilled at iOutputReportRate
+	// per second. Input polls always go out and only use up tokens, but a
+	// quarter of the rate is reserved for feedback so they can't starve it.
+	// Feedback waits for tokens, rumble before LED, and only the newest rumble
+	// state is kept while it waits. Stopping the motors never waits. The LED
+	// is only sent when it changes.
+	class OutputGovernor {
+	public:
+		using clock = std::chrono::steady_clock;
+
+		explicit OutputGovernor(clock::time_point start);
+
+		void inputPoll(clock::time_point now);
+		void offerRumble(RumbleLevel level);
+		void offerLed(uchar led);
+		// The feedback update to send now, if any. Its tokens are taken, the
+		// caller has to send it.
+		OutputKind next(clock::time_point now);
+		// What next() returned last, valid until the next offer
+		RumbleLevel rumble() const;
+		uchar led() const;
+		// The device was reopened, nothing sent before counts any more
+		void reset();
+
+		OutputStats stats() const;
+
+	private:
+		void refill(clock::time_point now);
+		bool take(float cost, bool &waiting);
+		void takeAvailable(float cost);
+
+		float ratePerMs;
+		float burst;
+		float tokens; // Shared with input polls
+		float reserved; // Feedback only
+		clock::time_point lastRefill;
+
+		RumbleLevel pendingRumble{};
+		bool rumblePending{ false };
+		bool rumbleWaiting{ false }; // pendingRumble was already counted as deferred
+		bool rumbleActive{ false }; // The last rumble sent wasn't silence
+		uchar pendingLed{ 0 };
+		uchar sentLed{ 0xFF }; // Nothing is a valid LED, the first offer always goes
+		bool ledPending{ false };
+		bool ledWaiting{ false };
+		OutputStats totals{};
+	};
+
+};
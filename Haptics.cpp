@@ -0,0 +1,185 @@
+#include "Haptics.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <sstream>
+#include <unordered_map>
+
+#include "Config.hpp"
+
+namespace {
+	using namespace Procon;
+
+	const std::string userEffectName{ "sHapticUser" };
+	const std::array<std::string, static_cast<size_t>(HapticEvent::Count)> bindingNames{
+		"sHapticOnConnect",
+		"sHapticOnProfileSwitch",
+		"sHapticOnLowBattery"
+	};
+
+	constexpr uchar lowBattery{ 2 };
+
+	const HapticEffect click{
+		{ { 0xFF, 0xFF }, 20 }
+	};
+	const HapticEffect pulse{
+		{ { 0xC0, 0x00 }, 80 },
+		{ { 0x00, 0x00 }, 80 },
+		{ { 0xC0, 0x00 }, 80 }
+	};
+	const HapticEffect ramp{
+		{ { 0x20, 0x20 }, 100 },
+		{ { 0x60, 0x60 }, 100 },
+		{ { 0xA0, 0xA0 }, 100 },
+		{ { 0xFF, 0xFF }, 100 }
+	};
+	const HapticEffect heartbeat{
+		{ { 0xB0, 0x00 }, 60 },
+		{ { 0x00, 0x00 }, 100 },
+		{ { 0xFF, 0x00 }, 80 },
+		{ { 0x00, 0x00 }, 600 }
+	};
+
+	// sHapticUser is large:small:ms steps separated by commas, e.g. 255:0:50,0:0:50,255:255:100
+	HapticEffect parseUserEffect() {
+		HapticEffect effect;
+		const std::optional<std::string> value{ Config::get<std::string>(userEffectName) };
+		if (!value) {
+			return effect;
+		}
+		std::stringstream s{ *value };
+		std::string step;
+		while (std::getline(s, step, ',')) {
+			std::stringstream fields{ step };
+			unsigned int large{ 0 };
+			unsigned int small{ 0 };
+			unsigned int ms{ 0 };
+			char sep1{ 0 };
+			char sep2{ 0 };
+			if (!(fields >> large >> sep1 >> small >> sep2 >> ms) || sep1 != ':' || sep2 != ':') {
+				throw ConfigError("Invalid " + userEffectName + " step: " + step);
+			}
+			effect.push_back({ { static_cast<uchar>(std::min(large, 255u)), static_cast<uchar>(std::min(small, 255u)) }, static_cast<unsigned short>(std::min(ms, 60000u)) });
+		}
+		return effect;
+	}
+
+	const std::unordered_map<std::string, const HapticEffect*>& effectLibrary() {
+		static const HapticEffect user{ parseUserEffect() };
+		static const std::unordered_map<std::string, const HapticEffect*> library{
+			{ "click", &click },
+			{ "pulse", &pulse },
+			{ "ramp", &ramp },
+			{ "heartbeat", &heartbeat },
+			{ "user", &user }
+		};
+		return library;
+	}
+};
+
+namespace Procon {
+
+	const HapticEffect* findHapticEffect(const std::string &name) {
+		const auto &library = effectLibrary();
+		auto it = library.find(name);
+		if (it == library.end() || it->second->empty()) {
+			return nullptr;
+		}
+		return it->second;
+	}
+
+	Haptics::Haptics(unsigned int tickMs) :tickMs(std::max(1u, tickMs)) {
+		for (size_t i{ 0 }; i < bindings.size(); ++i) {
+			const std::optional<std::string> name{ Config::get<std::string>(bindingNames[i]) };
+			if (name && *name != "None") {
+				bindings[i] = findHapticEffect(*name);
+				if (bindings[i] == nullptr) {
+					throw ConfigError(bindingNames[i] + " is not a haptic effect: " + *name);
+				}
+			}
+		}
+	}
+
+	void Haptics::trigger(HapticEvent event) {
+		const HapticEffect *effect = bindings[static_cast<size_t>(event)];
+		if (effect != nullptr) {
+			play(*effect);
+		}
+	}
+
+	void Haptics::play(const HapticEffect &effect) {
+		const uchar voice{ static_cast<uchar>(nextVoice) };
+		nextVoice = (nextVoice + 1) % voiceCount;
+
+		// Replaces whatever this voice was playing, its old changes go stale
+		const uchar generation{ ++voiceGenerations[voice] };
+		voices[voice] = { 0, 0 };
+		size_t offset{ 0 };
+		for (const HapticStep &step : effect) {
+			schedule(offset, { voice, generation, step.level, 0 });
+			offset += std::max<size_t>(1, (step.durationMs + tickMs / 2) / tickMs);
+		}
+		schedule(offset, { voice, generation, { 0, 0 }, 0 });
+		voiceEnds[voice] = offset + 1;
+	}
+
+	void Haptics::schedule(size_t ticksFromNow, const Change &change) {
+		Slot &slot = wheel[(cursor + ticksFromNow) % wheelSlots];
+		if (slot.count == slotCapacity) {
+			++droppedChanges;
+			return;
+		}
+		Change c{ change };
+		c.rounds = static_cast<unsigned short>(ticksFromNow / wheelSlots);
+		slot.changes[slot.count++] = c;
+	}
+
+	RumbleLevel Haptics::tick() {
+		Slot &slot = wheel[cursor];
+		size_t kept{ 0 };
+		for (size_t i{ 0 }; i < slot.count; ++i) {
+			Change &c = slot.changes[i];
+			if (c.rounds > 0) {
+				--c.rounds;
+				slot.changes[kept++] = c;
+				continue;
+			}
+			if (c.generation == voiceGenerations[c.voice]) {
+				voices[c.voice] = c.level;
+			}
+		}
+		slot.count = kept;
+		cursor = (cursor + 1) % wheelSlots;
+
+		RumbleLevel out{ 0, 0 };
+		for (size_t v{ 0 }; v < voiceCount; ++v) {
+			if (voiceEnds[v] > 0) {
+				--voiceEnds[v];
+				out.large = std::max(out.large, voices[v].large);
+				out.small = std::max(out.small, voices[v].small);
+			}
+		}
+		return out;
+	}
+
+	void Haptics::setBattery(uchar level, bool charging) {
+		const bool low{ level <= lowBattery && !charging };
+		if (low && !batteryLow) {
+			trigger(HapticEvent::LowBattery);
+		}
+		batteryLow = low;
+	}
+
+	bool Haptics::enabled() const {
+		return std::any_of(bindings.begin(), bindings.end(), [](const HapticEffect *e) { return e != nullptr; });
+	}
+
+	bool Haptics::active() const {
+		return std::any_of(voiceEnds.begin(), voiceEnds.end(), [](size_t ticks) { return ticks > 0; });
+	}
+
+	size_t Haptics::dropped() const {
+		return droppedChanges;
+	}
+
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "Common.hpp"
+
+namespace Procon {
+
+	struct RumbleLevel {
+		uchar large;
+		uchar small;
+	};
+
+	// One step of an effect, held for durationMs
+	struct HapticStep {
+		RumbleLevel level;
+		unsigned short durationMs;
+	};
+	using HapticEffect = std::vector<HapticStep>;
+
+	// Things that can have an effect bound to them in the config
+	enum class HapticEvent {
+		Connected,
+		ProfileSwitch,
+		LowBattery,
+		Count
+	};
+
+	// Finds one of the built in effects (click, pulse, ramp, heartbeat) or the
+	// user effect from sHapticUser. Returns nullptr for None or unknown names.
+	const HapticEffect* findHapticEffect(const std::string &name);
+
+	// Per-controller haptic effect scheduler.
+	// Effects are split into level changes placed on a timer wheel whose tick is
+	// the controller's status interval, so they come out on the same cadence
+	// as forwarded game rumble. tick() advances one interval and returns the
+	// effect level, which the caller mixes with game rumble by max amplitude.
+	class Haptics {
+	public:
+		explicit Haptics(unsigned int tickMs);
+
+		void trigger(HapticEvent event);
+		void play(const HapticEffect &effect);
+		RumbleLevel tick();
+
+		// Battery level from the input report, 0 (empty) to 8 (full)
+		void setBattery(uchar level, bool charging);
+
+		bool enabled() const; // Any event has an effect bound
+		bool active() const; // An effect is playing
+		size_t dropped() const; // Level changes lost because their slot was full
+
+	private:
+		static constexpr size_t wheelSlots{ 64 };
+		static constexpr size_t slotCapacity{ 8 };
+		static constexpr size_t voiceCount{ 4 };
+
+		struct Change {
+			uchar voice;
+			uchar generation; // Which play() of the voice this belongs to
+			RumbleLevel level;
+			unsigned short rounds; // Full turns of the wheel left before it applies
+		};
+		struct Slot {
+			std::array<Change, slotCapacity> changes;
+			size_t count;
+		};
+
+		void schedule(size_t ticksFromNow, const Change &change);
+
+		unsigned int tickMs;
+		std::array<const HapticEffect*, static_cast<size_t>(HapticEvent::Count)> bindings{};
+		std::array<Slot, wheelSlots> wheel{};
+		size_t cursor{ 0 };
+		std::array<RumbleLevel, voiceCount> voices{};
+		std::array<size_t, voiceCount> voiceEnds{}; // Ticks left until each voice is done
+		std::array<uchar, voiceCount> voiceGenerations{};
+		size_t nextVoice{ 0 };
+		size_t droppedChanges{ 0 };
+		bool batteryLow{ false };
+	};
+
+};
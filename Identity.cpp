@@ -0,0 +1,101 @@
+#include "Identity.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+#include "Config.hpp"
+
+namespace {
+	using namespace Procon;
+
+	const std::string cacheFileName{ "sIdentityCache" };
+	const std::string defaultCacheFile{ "identities.txt" };
+
+	struct CachedColors {
+		uint32_t body;
+		uint32_t buttons;
+	};
+
+	std::mutex cacheMutex;
+	bool loaded{ false };
+	std::unordered_map<std::string, CachedColors> colors; // By ControllerIdentity::macString()
+
+	std::string cacheFile() {
+		return Config::get<std::string>(cacheFileName).value_or(defaultCacheFile);
+	}
+
+	// One controller per line: MAC, body color, button color, tab separated
+	void load() {
+		loaded = true;
+		const std::string file{ cacheFile() };
+		if (file.empty() || file == "None") {
+			return;
+		}
+		std::ifstream in{ file };
+		std::string line;
+		while (std::getline(in, line)) {
+			std::stringstream fields{ line };
+			std::string mac;
+			CachedColors entry{};
+			if (!std::getline(fields, mac, '\t') || mac.size() != 17
+				|| !(fields >> std::hex >> entry.body >> entry.buttons) || !(fields >> std::ws).eof()) {
+				continue; // Damaged lines, and the older per-port format, are read again
+			}
+			colors[mac] = entry;
+		}
+	}
+
+	void save() {
+		const std::string file{ cacheFile() };
+		if (file.empty() || file == "None") {
+			return;
+		}
+		std::ofstream out{ file, std::ios::trunc };
+		out << std::hex << std::setfill('0');
+		for (const auto &[mac, entry] : colors) {
+			out << mac << '\t' << std::setw(6) << entry.body << '\t' << std::setw(6) << entry.buttons << '\n';
+		}
+	}
+};
+
+namespace Procon {
+
+	std::string ControllerIdentity::macString() const {
+		std::stringstream s;
+		s << std::hex << std::uppercase << std::setfill('0');
+		for (size_t i{ 0 }; i < mac.size(); ++i) {
+			if (i != 0) {
+				s << ':';
+			}
+			s << std::setw(2) << static_cast<int>(mac[i]);
+		}
+		return s.str();
+	}
+
+	bool IdentityCache::findColors(ControllerIdentity &identity) {
+		std::lock_guard<std::mutex> lock{ cacheMutex };
+		if (!loaded) {
+			load();
+		}
+		auto it = colors.find(identity.macString());
+		if (it == colors.end()) {
+			return false;
+		}
+		identity.bodyColor = it->second.body;
+		identity.buttonColor = it->second.buttons;
+		return true;
+	}
+
+	void IdentityCache::store(const ControllerIdentity &identity) {
+		std::lock_guard<std::mutex> lock{ cacheMutex };
+		if (!loaded) {
+			load();
+		}
+		colors[identity.macString()] = { identity.bodyColor, identity.buttonColor };
+		save();
+	}
+
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "Common.hpp"
+
+namespace Procon {
+
+	// Who a controller is, independent of enumeration order
+	struct ControllerIdentity {
+		std::string key; // HID serial and path, tells devices apart while enumerating
+		std::array<uchar, 6> mac; // Bluetooth address, unique per controller, asked on every open
+		uchar firmwareMajor;
+		uchar firmwareMinor;
+		uint32_t bodyColor; // 0xRRGGBB from SPI flash
+		uint32_t buttonColor;
+
+		std::string macString() const; // "98:B6:E9:12:34:56"
+	};
+
+	// Colors read from controllers' SPI flash, kept in the sIdentityCache
+	// file by MAC so a controller seen before isn't read again. Every Pro
+	// Controller has the same HID serial, only the MAC tells them apart.
+	class IdentityCache {
+	public:
+		IdentityCache() = delete;
+		IdentityCache(const IdentityCache&) = delete;
+		IdentityCache& operator=(const IdentityCache&) = delete;
+
+		// Fills in identity's colors if its MAC was seen before
+		static bool findColors(ControllerIdentity &identity);
+		// Adds or replaces the colors stored for identity's MAC and rewrites
+		// the cache file
+		static void store(const ControllerIdentity &identity);
+	};
+
+};
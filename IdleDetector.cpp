@@ -0,0 +1,142 @@
+#include "IdleDetector.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+
+#include "Controller.hpp"
+#include "Config.hpp"
+#include "ReportView.hpp"
+
+namespace {
+	const std::string idleTimeoutName{ "iIdleTimeoutMs" };
+	const std::string idlePollName{ "iIdlePollIntervalMs" };
+	const std::string stickNoiseName{ "iIdleStickNoise" };
+	const std::string motionNoiseName{ "iIdleMotionNoise" };
+	const std::string expectedReportName{ "iExpectedReportMs" };
+
+	constexpr int defaultIdleTimeout{ 10000 };
+	constexpr int defaultIdlePoll{ 100 };
+	constexpr int defaultStickNoise{ 3 };
+	constexpr int defaultMotionNoise{ 150 };
+	constexpr int defaultExpectedReport{ 8 };
+	constexpr int rawStickToXInput{ 256 }; // One raw stick unit (0-255) in XInput units, before range calibration
+
+	bool exceeds(int a, int b, int threshold) {
+		return std::abs(a - b) > threshold;
+	}
+};
+
+namespace Procon {
+
+	IdleDetector::IdleDetector(clock::time_point start) :lastActivity(start), lastPoll(start), modeStart(start) {
+		using std::chrono::milliseconds;
+
+		idleAfter = milliseconds(Config::get<int32_t>(idleTimeoutName).value_or(defaultIdleTimeout));
+		idlePollInterval = milliseconds(Config::get<int32_t>(idlePollName).value_or(defaultIdlePoll));
+		// Set in raw stick units, compared against the mapped sticks
+		stickThreshold = Config::get<int32_t>(stickNoiseName).value_or(defaultStickNoise) * rawStickToXInput;
+		motionThreshold = Config::get<int32_t>(motionNoiseName).value_or(defaultMotionNoise);
+		reportPeriod = milliseconds(std::max(1, Config::get<int32_t>(expectedReportName).value_or(defaultExpectedReport)));
+	}
+
+	bool IdleDetector::shouldPoll(clock::time_point now) {
+		if (isIdle) {
+			if (now < lastPoll + idlePollInterval) {
+				return false;
+			}
+			// At full rate there would have been a poll every report period since the last one
+			const auto periods = (now - lastPoll) / reportPeriod;
+			if (periods > 1) {
+				totals.skippedPolls += static_cast<size_t>(periods - 1);
+			}
+		}
+		lastPoll = now;
+		return true;
+	}
+
+	void IdleDetector::update(const ExpandedPadState &state, ReportView &report, clock::time_point now) {
+		// A held button or stick is not idle even if it doesn't change, releasing it shouldn't lag.
+		// The mapped state is already there, the IMU samples are only unpacked when it's quiet.
+		if (held(state) || changed(state) || moved(report)) {
+			remember(state);
+			markActive(now);
+			return;
+		}
+		// iIdleTimeoutMs = 0 disables idle polling
+		if (!isIdle && idleAfter > clock::duration::zero() && now >= lastActivity + idleAfter) {
+			totals.activeTime += now - modeStart;
+			modeStart = now;
+			isIdle = true;
+			++totals.idleEntries;
+		}
+	}
+
+	void IdleDetector::markActive(clock::time_point now) {
+		lastActivity = now;
+		if (isIdle) {
+			totals.idleTime += now - modeStart;
+			modeStart = now;
+			isIdle = false;
+		}
+	}
+
+	bool IdleDetector::idle() const {
+		return isIdle;
+	}
+
+	IdleStats IdleDetector::stats(clock::time_point now) const {
+		IdleStats out{ totals };
+		if (isIdle) {
+			out.idleTime += now - modeStart;
+		}
+		else {
+			out.activeTime += now - modeStart;
+		}
+		return out;
+	}
+
+	bool IdleDetector::changed(const ExpandedPadState &state) const {
+		const XINPUT_GAMEPAD &x = state.xinState;
+		return x.wButtons != buttons || state.sharePressed != share
+			|| exceeds(x.sThumbLX, sticks[0], stickThreshold)
+			|| exceeds(x.sThumbLY, sticks[1], stickThreshold)
+			|| exceeds(x.sThumbRX, sticks[2], stickThreshold)
+			|| exceeds(x.sThumbRY, sticks[3], stickThreshold);
+	}
+
+	// Compares every sample, a short flick can be over before the next
+	// report's first one. A changed reading becomes the new reference.
+	bool IdleDetector::moved(ReportView &report) {
+		const std::array<MotionSample, 3> &samples = report.motion();
+		bool changed{ !gyroKnown };
+		for (const MotionSample &m : samples) {
+			for (size_t i{ 0 }; i < gyro.size(); ++i) {
+				changed = changed || exceeds(m.gyro[i], gyro[i], motionThreshold);
+			}
+		}
+		if (changed) {
+			const MotionSample &newest = samples[2];
+			gyro = { newest.gyro[0], newest.gyro[1], newest.gyro[2] };
+			gyroKnown = true;
+		}
+		return changed;
+	}
+
+	bool IdleDetector::held(const ExpandedPadState &state) const {
+		constexpr int heldStick{ 0x2000 }; // A quarter of full deflection
+		const XINPUT_GAMEPAD &x = state.xinState;
+		return x.wButtons != 0 || state.sharePressed
+			|| x.bLeftTrigger != 0 || x.bRightTrigger != 0
+			|| std::abs(x.sThumbLX) > heldStick || std::abs(x.sThumbLY) > heldStick
+			|| std::abs(x.sThumbRX) > heldStick || std::abs(x.sThumbRY) > heldStick;
+	}
+
+	void IdleDetector::remember(const ExpandedPadState &state) {
+		const XINPUT_GAMEPAD &x = state.xinState;
+		buttons = x.wButtons;
+		share = state.sharePressed;
+		sticks = { x.sThumbLX, x.sThumbLY, x.sThumbRX, x.sThumbRY };
+	}
+
+};
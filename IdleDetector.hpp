@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+
+#include "Common.hpp"
+
+namespace Procon {
+
+	struct ExpandedPadState;
+	class ReportView;
+
+	struct IdleStats {
+		std::chrono::steady_clock::duration activeTime{ 0 };
+		std::chrono::steady_clock::duration idleTime{ 0 };
+		size_t idleEntries{ 0 }; // Times the controller dropped to the idle poll rate
+		size_t skippedPolls{ 0 }; // Reports not polled because the controller was idle, counted every iExpectedReportMs
+	};
+
+	// Per-controller activity detector.
+	// Feed every report to update(), ask shouldPoll() before talking to the device.
+	// After iIdleTimeoutMs without a change bigger than the noise thresholds, and
+	// with nothing held down, the controller is only polled every
+	// iIdlePollIntervalMs. The first changed report switches back to full rate.
+	class IdleDetector {
+	public:
+		using clock = std::chrono::steady_clock;
+
+		explicit IdleDetector(clock::time_point start);
+
+		bool shouldPoll(clock::time_point now);
+		// Reads the mapped xinState and sharePressed from state, and the gyro
+		// from report only while the mapped state shows no activity
+		void update(const ExpandedPadState &state, ReportView &report, clock::time_point now);
+		// Activity the reports don't show, like injected input
+		void markActive(clock::time_point now);
+
+		bool idle() const;
+		IdleStats stats(clock::time_point now) const;
+
+	private:
+		bool changed(const ExpandedPadState &state) const;
+		bool held(const ExpandedPadState &state) const;
+		bool moved(ReportView &report);
+		void remember(const ExpandedPadState &state);
+
+		clock::duration idleAfter;
+		clock::duration idlePollInterval;
+		clock::duration reportPeriod; // iExpectedReportMs, the full rate cadence
+		int stickThreshold;
+		int motionThreshold;
+
+		bool isIdle{ false };
+		clock::time_point lastActivity;
+		clock::time_point lastPoll;
+		clock::time_point modeStart;
+		IdleStats totals{};
+
+		// Reference values changes are measured against
+		unsigned short buttons{ 0 };
+		bool share{ false };
+		std::array<int, 4> sticks{}; // Mapped, XInput units
+		std::array<int, 3> gyro{};
+		bool gyroKnown{ false }; // gyro is from the last report that was checked for motion
+	};
+
+};
@@ -0,0 +1,159 @@
+#include "Injection.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "Config.hpp"
+#include "Controller.hpp"
+
+namespace {
+	using namespace Procon;
+
+	const std::string injectionName{ "bInjection" };
+	const std::string priorityName{ "iInjectPriority" };
+
+	constexpr int centeredStick{ 0x2000 }; // A quarter of full deflection
+
+	std::string mappingName(unsigned int port) {
+		return "Local\\ProconXInputInject" + std::to_string(port);
+	}
+
+	bool centered(short x, short y) {
+		return std::abs(x) < centeredStick && std::abs(y) < centeredStick;
+	}
+};
+
+namespace Procon {
+
+	InjectionReader::InjectionReader(unsigned int port) {
+		if (!Config::get<bool>(injectionName).value_or(false)) {
+			return;
+		}
+		priority = static_cast<InjectPriority>(std::clamp(Config::get<int32_t>(priorityName).value_or(0), 0, 2));
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(InjectionRing), mappingName(port).c_str());
+		if (mapping == nullptr) {
+			throw ControllerException("Unable to create the input injection ring.");
+		}
+		void *view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(InjectionRing));
+		if (view == nullptr) {
+			CloseHandle(mapping);
+			throw ControllerException("Unable to map the input injection ring.");
+		}
+		ring = new (view) InjectionRing{};
+		ring->magic = injectionMagic;
+		ring->version = injectionVersion;
+	}
+
+	InjectionReader::InjectionReader(InjectionReader &&other) noexcept {
+		*this = std::move(other);
+	}
+
+	InjectionReader& InjectionReader::operator=(InjectionReader &&other) noexcept {
+		if (this != &other) {
+			release();
+			mapping = std::exchange(other.mapping, nullptr);
+			ring = std::exchange(other.ring, nullptr);
+			tail = other.tail;
+			active = other.active;
+			current = other.current;
+			until = other.until;
+			priority = other.priority;
+		}
+		return *this;
+	}
+
+	InjectionReader::~InjectionReader() {
+		release();
+	}
+
+	void InjectionReader::release() {
+		if (ring != nullptr) {
+			UnmapViewOfFile(ring);
+			ring = nullptr;
+		}
+		if (mapping != nullptr) {
+			CloseHandle(mapping);
+			mapping = nullptr;
+		}
+	}
+
+	bool InjectionReader::merge(XINPUT_GAMEPAD &pad, clock::time_point now) {
+		if (ring == nullptr) {
+			return false;
+		}
+		const uint32_t head{ ring->head.load(std::memory_order_acquire) };
+		if (head != tail) {
+			// Only the newest entry matters, each one replaces the last
+			current = ring->entries[(head - 1) % injectionCapacity];
+			tail = head;
+			ring->tail.store(tail, std::memory_order_release);
+			active = current.durationMs != 0;
+			until = now + std::chrono::milliseconds(current.durationMs);
+		}
+		if (!active) {
+			return false;
+		}
+		if (now >= until) {
+			active = false;
+			return false;
+		}
+
+		if (priority == InjectPriority::Exclusive) {
+			pad = { 0 };
+		}
+		pad.wButtons |= current.buttons;
+		const bool replace{ priority != InjectPriority::Physical };
+		if (current.flags & InjectedInput::Triggers) {
+			pad.bLeftTrigger = replace ? current.leftTrigger : std::max(pad.bLeftTrigger, current.leftTrigger);
+			pad.bRightTrigger = replace ? current.rightTrigger : std::max(pad.bRightTrigger, current.rightTrigger);
+		}
+		if ((current.flags & InjectedInput::LeftStick) && (replace || centered(pad.sThumbLX, pad.sThumbLY))) {
+			pad.sThumbLX = current.thumbLX;
+			pad.sThumbLY = current.thumbLY;
+		}
+		if ((current.flags & InjectedInput::RightStick) && (replace || centered(pad.sThumbRX, pad.sThumbRY))) {
+			pad.sThumbRX = current.thumbRX;
+			pad.sThumbRY = current.thumbRY;
+		}
+		return true;
+	}
+
+	bool InjectionReader::pending() const {
+		return ring != nullptr && (active || ring->head.load(std::memory_order_acquire) != tail);
+	}
+
+	InjectionWriter::InjectionWriter(unsigned int port) {
+		mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, mappingName(port).c_str());
+		if (mapping == nullptr) {
+			throw std::runtime_error("Virtual pad has no injection ring, is bInjection set?");
+		}
+		ring = static_cast<InjectionRing*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(InjectionRing)));
+		if (ring == nullptr || ring->magic != injectionMagic || ring->version != injectionVersion) {
+			if (ring != nullptr) {
+				UnmapViewOfFile(ring);
+			}
+			CloseHandle(mapping);
+			throw std::runtime_error("Injection ring has an unknown layout");
+		}
+	}
+
+	InjectionWriter::~InjectionWriter() {
+		UnmapViewOfFile(ring);
+		CloseHandle(mapping);
+	}
+
+	bool InjectionWriter::push(const InjectedInput &input) {
+		const uint32_t head{ ring->head.load(std::memory_order_relaxed) };
+		if (head - ring->tail.load(std::memory_order_acquire) >= injectionCapacity) {
+			return false;
+		}
+		ring->entries[head % injectionCapacity] = input;
+		ring->head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <Xinput.h>
+
+namespace Procon {
+
+	// Input an external process injects into a virtual pad. It replaces the
+	// previous injected input and is held for durationMs, 0 releases it.
+	struct InjectedInput {
+		enum Flags : uint8_t {
+			LeftStick = 0x1, // thumbLX/LY are set
+			RightStick = 0x2, // thumbRX/RY are set
+			Triggers = 0x4 // leftTrigger/rightTrigger are set
+		};
+		uint16_t buttons; // XINPUT_GAMEPAD_* buttons to press
+		uint8_t flags;
+		uint8_t leftTrigger;
+		uint8_t rightTrigger;
+		int16_t thumbLX;
+		int16_t thumbLY;
+		int16_t thumbRX;
+		int16_t thumbRY;
+		uint32_t durationMs;
+	};
+
+	// Shared memory layout of "Local\ProconXInputInject<port>", one per
+	// virtual pad. Single producer (the injecting tool), single consumer (the
+	// poll thread), lock-free.
+	constexpr uint32_t injectionMagic{ 0x4A4E4950 }; // "PINJ"
+	constexpr uint32_t injectionVersion{ 1 };
+	constexpr uint32_t injectionCapacity{ 64 };
+	struct InjectionRing {
+		uint32_t magic;
+		uint32_t version;
+		alignas(64) std::atomic<uint32_t> head; // Entries written, by the tool
+		alignas(64) std::atomic<uint32_t> tail; // Entries read, by ProconXInput
+		std::array<InjectedInput, injectionCapacity> entries;
+	};
+	static_assert(std::atomic<uint32_t>::is_always_lock_free, "Ring indices must be lock-free to be shared between processes");
+
+	// How injected input combines with the physical controller, iInjectPriority
+	enum class InjectPriority {
+		Physical, // Buttons are combined, injected sticks only apply while the physical ones are centered
+		Injected, // Buttons are combined, injected sticks and triggers replace the physical ones
+		Exclusive // The physical controller is ignored while an injection is held
+	};
+
+	// Poll thread side. Creates the ring for a virtual pad if bInjection is
+	// set and merges what tools wrote into each report before XOutput.
+	// Costs one atomic load per report while nothing is injected.
+	// Throws ControllerException if the ring can't be created.
+	class InjectionReader {
+	public:
+		using clock = std::chrono::steady_clock;
+
+		explicit InjectionReader(unsigned int port);
+		InjectionReader(InjectionReader &&other) noexcept;
+		InjectionReader& operator=(InjectionReader &&other) noexcept;
+		InjectionReader(const InjectionReader&) = delete;
+		InjectionReader& operator=(const InjectionReader&) = delete;
+		~InjectionReader();
+
+		// Returns true if an injected input was applied to pad
+		bool merge(XINPUT_GAMEPAD &pad, clock::time_point now);
+		// An injection is held or waiting in the ring, merge() has work to do
+		bool pending() const;
+
+	private:
+		void release();
+
+		HANDLE mapping{ nullptr };
+		InjectionRing *ring{ nullptr };
+		uint32_t tail{ 0 };
+		bool active{ false }; // An injected input is being held
+		InjectedInput current{};
+		clock::time_point until{};
+		InjectPriority priority{ InjectPriority::Physical };
+	};
+
+	// Tool side, opens the ring ProconXInput created for a virtual pad
+	class InjectionWriter {
+	public:
+		explicit InjectionWriter(unsigned int port); // Throws std::runtime_error if the pad has no ring
+		InjectionWriter(const InjectionWriter&) = delete;
+		InjectionWriter& operator=(const InjectionWriter&) = delete;
+		~InjectionWriter();
+
+		// Returns false if the ring is full
+		bool push(const InjectedInput &input);
+
+	private:
+		HANDLE mapping{ nullptr };
+		InjectionRing *ring{ nullptr };
+	};
+
+};
@@ -0,0 +1,226 @@
+#include "LatencyRig.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <Xinput.h>
+
+#include "Config.hpp"
+#include "Controller.hpp"
+#include "XOutput.hpp"
+
+namespace {
+	using namespace Procon;
+	using clock = Controller::clock;
+
+	constexpr uchar rigPort{ 0 };
+	constexpr auto reportInterval = std::chrono::milliseconds(8); // Procon USB report rate
+	constexpr size_t reportsPerEdge{ 5 }; // A is toggled every 40ms
+	constexpr size_t edgesPerStrategy{ 500 };
+	constexpr uchar buttonA{ 0x08 }; // Right button byte
+
+	// Builds USB input replies like the ones pollInput() reads
+	class SimulatedProcon {
+		std::array<uchar, exchangeLen> reply{};
+	public:
+		SimulatedProcon() {
+			reply[0] = 0x81;
+			reply[1] = 0x92;
+			reply[3] = 0x31;
+			reply[10] = 0x30;
+			reply[12] = 0x90; // Full battery, not charging
+			// Both sticks centered, 12 bits per axis
+			for (size_t stick : { 16, 19 }) {
+				reply[stick] = 0x00;
+				reply[stick + 1] = 0x08;
+				reply[stick + 2] = 0x80;
+			}
+			reply[27] = 0x00; // Accel Z reads 1g, flat on a table
+			reply[28] = 0x10;
+		}
+		const uchar* next(bool pressA) {
+			++reply[11];
+			reply[13] = pressA ? buttonA : 0;
+			return reply.data();
+		}
+	};
+
+	struct Strategy {
+		const char *name;
+		void(*wait)();
+	};
+	void waitYield() {
+		std::this_thread::yield();
+	}
+	void waitSleep() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	const std::array<Strategy, 2> strategies{ {
+		{ "yield", waitYield },
+		{ "sleep 1ms", waitSleep }
+	} };
+
+	// A button edge, in steady_clock ticks
+	struct Edge {
+		clock::rep time;
+		bool pressed;
+	};
+	// Each list is written by one thread, and only read once the reader has joined
+	struct EdgeLog {
+		std::vector<Edge> sent;
+		std::vector<Edge> seen;
+		size_t maxSeen; // Room for every sent edge twice, so a flickering pad can't allocate mid-run
+		explicit EdgeLog(size_t count) :maxSeen(count * 2) {
+			sent.reserve(count);
+			seen.reserve(maxSeen);
+		}
+	};
+
+	// Spins on XInputGetState and stamps each press and release. Any button
+	// counts, A may be mapped to B by bMatchButtonLabels.
+	void readBack(DWORD userIndex, EdgeLog &log, const std::atomic<bool> &running) {
+		bool lastPressed{ false };
+		while (running.load(std::memory_order_relaxed) && log.seen.size() < log.maxSeen) {
+			XINPUT_STATE state;
+			if (XInputGetState(userIndex, &state) != ERROR_SUCCESS) {
+				std::this_thread::yield();
+				continue;
+			}
+			const bool pressed{ state.Gamepad.wButtons != 0 };
+			if (pressed != lastPressed) {
+				log.seen.push_back({ clock::now().time_since_epoch().count(), pressed });
+				lastPressed = pressed;
+			}
+		}
+	}
+
+	struct Measurement {
+		std::vector<double> latencies;
+		size_t missed; // Sent edges never seen
+		size_t extra; // Seen edges with no sent edge left to match
+	};
+
+	// Pairs each seen edge with the newest edge of the same direction sent
+	// before it, so a missed or doubled edge only loses its own sample
+	Measurement pairEdges(const EdgeLog &log) {
+		Measurement result{ {}, 0, 0 };
+		std::vector<bool> paired(log.sent.size(), false);
+		size_t sentBefore{ 0 };
+		for (const Edge &seen : log.seen) {
+			while (sentBefore < log.sent.size() && log.sent[sentBefore].time <= seen.time) {
+				++sentBefore;
+			}
+			size_t match{ sentBefore };
+			while (match > 0 && log.sent[match - 1].pressed != seen.pressed) {
+				--match;
+			}
+			if (match == 0 || paired[match - 1]) {
+				++result.extra;
+				continue;
+			}
+			paired[match - 1] = true;
+			const clock::duration latency{ seen.time - log.sent[match - 1].time };
+			result.latencies.push_back(std::chrono::duration<double, std::milli>(latency).count());
+		}
+		result.missed = log.sent.size() - result.latencies.size();
+		return result;
+	}
+
+	void printDistribution(std::ostream &out, const char *name, Measurement &result) {
+		std::vector<double> &latencies = result.latencies;
+		out << name << ": ";
+		if (latencies.empty()) {
+			out << "no edges seen\n";
+			return;
+		}
+		std::sort(latencies.begin(), latencies.end());
+		const auto percentile = [&latencies](double p) {
+			return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+		};
+		out << latencies.size() << " edges, min " << latencies.front()
+			<< "ms, median " << percentile(0.5)
+			<< "ms, p95 " << percentile(0.95)
+			<< "ms, p99 " << percentile(0.99)
+			<< "ms, max " << latencies.back() << "ms, "
+			<< result.missed << " missed, " << result.extra << " unmatched\n";
+	}
+
+	Measurement measure(Controller &controller, DWORD userIndex, const Strategy &strategy) {
+		EdgeLog log{ edgesPerStrategy };
+		std::atomic<bool> running{ true };
+		std::thread reader{ readBack, userIndex, std::ref(log), std::cref(running) };
+
+		SimulatedProcon procon;
+		bool pressA{ false };
+		size_t report{ 0 };
+		clock::time_point due{ clock::now() };
+		while (log.sent.size() < edgesPerStrategy) {
+			while (clock::now() < due) {
+				strategy.wait();
+			}
+			if (report++ % reportsPerEdge == 0) {
+				pressA = !pressA;
+				log.sent.push_back({ due.time_since_epoch().count(), pressA });
+			}
+			controller.processReport(procon.next(pressA), exchangeLen, clock::now());
+			due += reportInterval;
+		}
+		// Give the last edge time to come through, then release A for the next run
+		std::this_thread::sleep_for(reportInterval * reportsPerEdge);
+		running.store(false, std::memory_order_relaxed);
+		reader.join();
+		if (pressA) {
+			controller.processReport(procon.next(false), exchangeLen, clock::now());
+		}
+
+		return pairEdges(log);
+	}
+};
+
+namespace Procon {
+
+	int runLatencyRig(std::ostream &out) {
+		try {
+			Controller controller{ rigPort };
+			controller.plugIn();
+
+			// The virtual pad shows up in XInput a moment after being plugged in
+			DWORD userIndex{ XUSER_MAX_COUNT };
+			for (int tries{ 0 }; tries < 100; ++tries) {
+				if (XOutput::XOutputGetRealUserIndex(rigPort, &userIndex) == ERROR_SUCCESS && userIndex < XUSER_MAX_COUNT) {
+					break;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			}
+			if (userIndex >= XUSER_MAX_COUNT) {
+				out << "Simulated controller never appeared in XInput.\n";
+				return -1;
+			}
+
+			out << "Measuring report to XInput latency, " << edgesPerStrategy << " edges per strategy...\n";
+			for (const Strategy &strategy : strategies) {
+				Measurement result{ measure(controller, userIndex, strategy) };
+				printDistribution(out, strategy.name, result);
+			}
+		}
+		catch (ControllerException &e) {
+			out << "ControllerException: " << e.what() << '\n';
+			return -1;
+		}
+		catch (const ConfigError &e) {
+			out << "Error in config file: " << e.what() << '\n';
+			return -1;
+		}
+		return 0;
+	}
+
+};
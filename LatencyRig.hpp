@@ -0,0 +1,17 @@
+#pragma once
+
+#include <ostream>
+
+namespace Procon {
+
+	// End to end latency test, run with --latency-rig instead of real controllers.
+	// A simulated Procon produces a USB input reply every 8ms, the way the real
+	// one does, pressing and releasing A every few reports. Each reply goes
+	// through the full pipeline into XOutput, and a second thread reads the
+	// virtual pad back with XInputGetState. The time from a reply being ready
+	// to its button edge showing up in XInput is measured for each way the
+	// main loop can wait for the next report, and the distribution printed.
+	// Needs ScpVBus and a free XOutput port. Returns non-zero on failure.
+	int runLatencyRig(std::ostream &out);
+
+};
@@ -0,0 +1,898 @@
+#include "Pipeline.hpp"
+
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#ifdef _DEBUG
+#include <iostream>
+#endif
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "Controller.hpp"
+#include "Config.hpp"
+#include "ReportLayout.hpp"
+#include "ReportView.hpp"
+
+namespace {
+	using std::array;
+	using namespace Procon;
+
+	// Validation masks, read as little endian words like x86 and ARM load them.
+	// Header bytes 0, 1 and 3 are the USB reply (0x81 0x92 ?? 0x31).
+	constexpr uint32_t headerMask{ 0xFF00FFFF };
+	constexpr uint32_t headerBits{ 0x31009281 };
+
+	// The report id and reserved button bits of a layout as one 64 bit compare
+	// over bytes [window, window + 8)
+	constexpr size_t statusWindow{ 8 };
+	constexpr uint64_t byteAt(size_t offset, uint64_t value) {
+		return value << ((offset - statusWindow) * 8);
+	}
+	constexpr uint64_t statusMaskOf(const ReportLayout &layout) {
+		return byteAt(layout.idOffset, 0xFF)
+			| byteAt(findField(layout, ReportField::LeftButtons).offset, layout.reservedBits[static_cast<size_t>(ButtonSource::Left)])
+			| byteAt(findField(layout, ReportField::RightButtons).offset, layout.reservedBits[static_cast<size_t>(ButtonSource::Right)])
+			| byteAt(findField(layout, ReportField::MiddleButtons).offset, layout.reservedBits[static_cast<size_t>(ButtonSource::Middle)]);
+	}
+	static_assert(usbInputLayout.idOffset >= statusWindow && findField(usbInputLayout, ReportField::LeftButtons).offset < statusWindow + 8,
+		"Report id and button bytes must fall in the status window");
+	constexpr uint64_t statusMask{ statusMaskOf(usbInputLayout) };
+	constexpr uint64_t statusBits{ byteAt(usbInputLayout.idOffset, usbInputLayout.reportId) };
+
+	constexpr double lerp(double min, double max, double t) {
+		return (1.0 - t) * min + t * max;
+	}
+
+	// stick is current stick location, range is min/max of stick, center is center point of stick
+	void calibrateToRange(const StickPoint &stick, const StickRange &range, const StickPoint &center, short &outx, short &outy) {
+		constexpr float smax = std::numeric_limits<short>::max();
+		outx = static_cast<short>(smax * std::clamp((static_cast<float>(stick.x) - center.x) * range.x.scale, -1.0f, 1.0f));
+		outy = static_cast<short>(smax * std::clamp((static_cast<float>(stick.y) - center.y) * range.y.scale, -1.0f, 1.0f));
+	}
+
+	short expandUChar(uchar c) {
+		constexpr uchar ucmax = std::numeric_limits<uchar>::max();
+		constexpr short smax = std::numeric_limits<short>::max();
+		constexpr short smin = std::numeric_limits<short>::min();
+
+		double d = std::clamp(static_cast<double>(c) / ucmax, 0.0, 1.0);
+		return static_cast<short>( lerp(smin, smax, d) );
+	}
+
+
+	const array<Button, 8>& getButtonMap(ButtonSource s) {
+		switch (s) {
+		case ButtonSource::Left:
+		case ButtonSource::Middle:
+		case ButtonSource::Right:
+			return usbInputLayout.buttons[static_cast<size_t>(s)];
+		default:
+			throw std::logic_error("Unknown ButtonSource passed to getButtonMap");
+		}
+	}
+
+	constexpr unsigned short buttonToReportBits(Button b){
+		switch (b) {
+		case Button::DPadUp:
+			return 0x0001;
+		case Button::DPadDown:
+			return 0x0002;
+		case Button::DPadLeft:
+			return 0x0004;
+		case Button::DPadRight:
+			return 0x0008;
+		case Button::Plus:
+			return 0x0010;
+		case Button::Minus:
+			return 0x0020;
+		case Button::LStick:
+			return 0x0040;
+		case Button::RStick:
+			return 0x0080;
+		case Button::L:
+			return 0x0100;
+		case Button::R:
+			return 0x0200;
+		case Button::Home:
+			return 0x0400; // Undocumented
+
+		// NOTICE: A and B are swapped, and X and Y are swapped.
+		case Button::A:
+			return 0x2000;
+		case Button::B:
+			return 0x1000;
+		case Button::X:
+			return 0x8000;
+		case Button::Y:
+			return 0x4000;
+		default:
+			return 0x0000;
+		}
+	}
+	constexpr unsigned short buttonToReportBitsOld(Button b) {
+		switch (b) {
+		case Button::DPadUp:
+			return 0x0001;
+		case Button::DPadDown:
+			return 0x0002;
+		case Button::DPadLeft:
+			return 0x0004;
+		case Button::DPadRight:
+			return 0x0008;
+		case Button::Plus:
+			return 0x0010;
+		case Button::Minus:
+			return 0x0020;
+		case Button::LStick:
+			return 0x0040;
+		case Button::RStick:
+			return 0x0080;
+		case Button::L:
+			return 0x0100;
+		case Button::R:
+			return 0x0200;
+		case Button::Home:
+			return 0x0400; // Undocumented
+
+		case Button::A:
+			return 0x1000;
+		case Button::B:
+			return 0x2000;
+		case Button::X:
+			return 0x4000;
+		case Button::Y:
+			return 0x8000;
+		default:
+			return 0x0000;
+		}
+	}
+
+
+	constexpr uchar rangeCenterBand{ 16 }; // Samples this close to center say nothing about the range
+	constexpr unsigned int rangeUpdateInterval{ 32 }; // Reports between percentile reads
+	constexpr float rangeRescaleAt{ 1.0e6f }; // Increment that triggers renormalizing a histogram
+
+	// O(1) per sample
+	void addRangeSample(AxisHistogram &h, uchar value, uchar center) {
+		if (std::abs(value - center) <= rangeCenterBand) {
+			return;
+		}
+		h.counts[value >> 1] += h.increment;
+	}
+
+	// Ages every sample so far, whether the stick moved or not. The rescale
+	// runs once every few minutes.
+	void fadeRangeSamples(AxisHistogram &h, float growth) {
+		h.increment *= growth;
+		if (h.increment > rangeRescaleAt) {
+			for (float &c : h.counts) {
+				c /= h.increment;
+			}
+			h.increment = 1.0f;
+		}
+	}
+
+	// Range between the low and high percentiles of the samples on each side
+	// of center. While a side has too few samples for the percentile to skip
+	// any, this is its extreme, like plain min/max.
+	AxisRange rangePercentiles(const AxisHistogram &h, uchar center, float percentile) {
+		const size_t centerBin{ static_cast<size_t>(center >> 1) };
+		float below{ 0.0f };
+		float above{ 0.0f };
+		for (size_t i{ 0 }; i < rangeBins; ++i) {
+			(i < centerBin ? below : above) += h.counts[i];
+		}
+		AxisRange range{ center, center, 0.0f };
+		float sum{ 0.0f };
+		for (size_t i{ 0 }; i < centerBin; ++i) {
+			sum += h.counts[i];
+			if (sum > below * percentile) {
+				range.min = static_cast<uchar>(i << 1);
+				break;
+			}
+		}
+		sum = 0.0f;
+		for (size_t i{ rangeBins }; i-- > centerBin;) {
+			sum += h.counts[i];
+			if (sum > above * percentile) {
+				range.max = static_cast<uchar>((i << 1) | 1);
+				break;
+			}
+		}
+		return range;
+	}
+
+	// Returns true if the range moved, the scale is only recomputed then
+	bool updateAxisRange(AxisRange &axis, const AxisHistogram &h, uchar center, float percentile) {
+		const AxisRange range{ rangePercentiles(h, center, percentile) };
+		if (range.min == axis.min && range.max == axis.max) {
+			return false;
+		}
+		axis.min = range.min;
+		axis.max = range.max;
+		axis.scale = 2.0f / std::max(1, axis.max - axis.min);
+		return true;
+	}
+
+	void updateCalibrationRange(const StickPoint &left, const StickPoint &right, float elapsed, const Profile &profile, RangeState &state, CalibrationData &cal) {
+		addRangeSample(state.axes[0], left.x, cal.leftCenter.x);
+		addRangeSample(state.axes[1], left.y, cal.leftCenter.y);
+		addRangeSample(state.axes[2], right.x, cal.rightCenter.x);
+		addRangeSample(state.axes[3], right.y, cal.rightCenter.y);
+		const float growth{ std::exp2(profile.rangeFadeRate * elapsed) };
+		for (AxisHistogram &h : state.axes) {
+			fadeRangeSamples(h, growth);
+		}
+		if (++state.sinceUpdate < rangeUpdateInterval) {
+			return;
+		}
+		state.sinceUpdate = 0;
+		updateAxisRange(cal.left.x, state.axes[0], cal.leftCenter.x, profile.rangePercentile);
+		updateAxisRange(cal.left.y, state.axes[1], cal.leftCenter.y, profile.rangePercentile);
+		updateAxisRange(cal.right.x, state.axes[2], cal.rightCenter.x, profile.rangePercentile);
+		updateAxisRange(cal.right.y, state.axes[3], cal.rightCenter.y, profile.rangePercentile);
+	}
+
+#ifdef _DEBUG
+	using std::string;
+
+	const string buttonA{ "A" };
+	const string buttonB{ "B" };
+	const string buttonX{ "X" };
+	const string buttonY{ "Y" };
+	const string buttonLStick{ "Left Stick" };
+	const string buttonRStick{ "Right Stick" };
+	const string buttonL{ "L" };
+	const string buttonR{ "R" };
+	const string buttonLZ{ "LZ" };
+	const string buttonRZ{ "RZ" };
+	const string buttonHome{ "Home" };
+	const string buttonShare{ "Share" };
+	const string buttonPlus{ "Plus" };
+	const string buttonMinus{ "Minus" };
+	const string buttonDPUp{ "DPad Up" };
+	const string buttonDPLeft{ "DPad Left" };
+	const string buttonDPRight{ "DPad Right" };
+	const string buttonDPDown{ "DPad Down" };
+	const string buttonNone{ "None" };
+	const string buttonUnknown{ "Unknown" };
+
+	const std::string& buttonToString(Button b) {
+		switch (b) {
+		case Button::A:
+			return buttonA;
+		case Button::B:
+			return buttonB;
+		case Button::X:
+			return buttonX;
+		case Button::Y:
+			return buttonY;
+		case Button::LStick:
+			return buttonLStick;
+		case Button::RStick:
+			return buttonRStick;
+		case Button::L:
+			return buttonL;
+		case Button::LZ:
+			return buttonLZ;
+		case Button::R:
+			return buttonR;
+		case Button::RZ:
+			return buttonRZ;
+		case Button::Home:
+			return buttonHome;
+		case Button::Share:
+			return buttonShare;
+		case Button::Plus:
+			return buttonPlus;
+		case Button::Minus:
+			return buttonMinus;
+		case Button::DPadDown:
+			return buttonDPDown;
+		case Button::DPadUp:
+			return buttonDPUp;
+		case Button::DPadLeft:
+			return buttonDPLeft;
+		case Button::DPadRight:
+			return buttonDPRight;
+		case Button::None:
+			return buttonNone;
+		default:
+			return buttonUnknown;
+		}
+	}
+#endif //#ifdef _DEBUG
+
+	// Stages. Each is a policy with a static apply(Frame&), a pipeline is a
+	// fixed list of them so every stage is inlined into one function.
+
+	// Tracks the stick range and sets state.xinState's sticks
+	struct CalibrateSticks {
+		static void apply(Frame &f) {
+			XINPUT_GAMEPAD &x = f.state.xinState;
+			CalibrationData &cal = f.calib;
+			const StickPoint &left = f.report.leftStick();
+			const StickPoint &right = f.report.rightStick();
+			updateCalibrationRange(left, right, f.elapsed, f.profile, f.processing.range, cal);
+
+			calibrateToRange(left, cal.left, cal.leftCenter, x.sThumbLX, x.sThumbLY);
+			calibrateToRange(right, cal.right, cal.rightCenter, x.sThumbRX, x.sThumbRY);
+		}
+	};
+
+	// Angle of every calibrated stick position in 1/256 turns, quantized into
+	// cells of 512x512. Shared by every controller so an angle is one lookup.
+	constexpr int gateCellShift{ 9 };
+	constexpr int gateCells{ 1 << (16 - gateCellShift) };
+	constexpr int gateAngles{ 256 };
+	constexpr int anglesPerSector{ gateAngles / static_cast<int>(gateSectors) };
+	static_assert(gateAngles % gateSectors == 0, "Sectors must split the angle table evenly");
+	using AngleTable = array<array<uchar, gateCells>, gateCells>;
+
+	AngleTable buildAngleTable() {
+		constexpr double pi{ 3.14159265358979323846 };
+		AngleTable table{};
+		for (int ix{ 0 }; ix < gateCells; ++ix) {
+			for (int iy{ 0 }; iy < gateCells; ++iy) {
+				const double angle{ std::atan2(iy - gateCells / 2 + 0.5, ix - gateCells / 2 + 0.5) };
+				const int step{ static_cast<int>((angle + pi) / (2.0 * pi) * gateAngles) };
+				table[ix][iy] = static_cast<uchar>(std::min(step, gateAngles - 1));
+			}
+		}
+		return table;
+	}
+	const AngleTable gateAngleTable{ buildAngleTable() };
+
+	// Octagonal gate correction. Learns the furthest the stick reaches in each
+	// sector and scales that to full deflection, so diagonals reach the edge of
+	// the circle instead of falling short or overshooting. The gain is blended
+	// between the two nearest sector centers so it never jumps at a boundary.
+	// Like the stick range, what was learned fades with fStickRangeHalfLife so
+	// one stray push or a previous controller's gate doesn't stay for good.
+	template<bool Enabled>
+	struct GateCorrection {
+		static void apply(Frame &) {}
+	};
+	template<>
+	struct GateCorrection<true> {
+		// Only pushes against the gate say where it is, anything short of this
+		// would turn partial deflection into full
+		static constexpr float minLearnedRadius{ 0.8f * std::numeric_limits<short>::max() };
+		// Fading every sector is only worth doing about once a second
+		static constexpr float fadeInterval{ 1.0f };
+
+		// Shrinks each learned radius toward minLearnedRadius, where any push
+		// against the gate teaches it again
+		static void fadeGate(GateShape &gate, float fadeRate) {
+			constexpr float smax = std::numeric_limits<short>::max();
+			const float keep{ std::exp2(-fadeRate * gate.unfaded) };
+			gate.unfaded = 0.0f;
+			for (size_t sector{ 0 }; sector < gateSectors; ++sector) {
+				if (gate.maxRadiusSq[sector] == 0) {
+					continue;
+				}
+				const float radius{ std::sqrt(static_cast<float>(gate.maxRadiusSq[sector])) };
+				const float faded{ minLearnedRadius + std::max(0.0f, radius - minLearnedRadius) * keep };
+				gate.maxRadiusSq[sector] = static_cast<int>(faded * faded);
+				gate.gain[sector] = smax / faded;
+			}
+		}
+
+		static void applyStick(short &x, short &y, GateShape &gate) {
+			constexpr float smax = std::numeric_limits<short>::max();
+			const int angle{ gateAngleTable[(x >> gateCellShift) + gateCells / 2][(y >> gateCellShift) + gateCells / 2] };
+			const size_t sector{ static_cast<size_t>(angle / anglesPerSector) };
+
+			const int radiusSq{ x * x + y * y };
+			if (radiusSq > gate.maxRadiusSq[sector]) {
+				const float radius{ std::sqrt(static_cast<float>(radiusSq)) };
+				if (radius >= minLearnedRadius) {
+					gate.maxRadiusSq[sector] = radiusSq;
+					gate.gain[sector] = smax / radius;
+				}
+			}
+
+			// In half steps from sector 0's center, blend the sectors either side
+			const int fromCenter{ angle * 2 + 1 - anglesPerSector + gateAngles * 2 };
+			const size_t below{ static_cast<size_t>(fromCenter / (anglesPerSector * 2)) % gateSectors };
+			const size_t above{ (below + 1) % gateSectors };
+			const float t{ static_cast<float>(fromCenter % (anglesPerSector * 2)) / (anglesPerSector * 2) };
+			const float gain{ gate.gain[below] + (gate.gain[above] - gate.gain[below]) * t };
+			x = static_cast<short>(std::clamp(x * gain, -smax, smax));
+			y = static_cast<short>(std::clamp(y * gain, -smax, smax));
+		}
+		static void apply(Frame &f) {
+			for (GateShape *gate : { &f.calib.leftGate, &f.calib.rightGate }) {
+				gate->unfaded += f.elapsed;
+				if (gate->unfaded >= fadeInterval) {
+					fadeGate(*gate, f.profile.rangeFadeRate);
+				}
+			}
+			XINPUT_GAMEPAD &x = f.state.xinState;
+			applyStick(x.sThumbLX, x.sThumbLY, f.calib.leftGate);
+			applyStick(x.sThumbRX, x.sThumbRY, f.calib.rightGate);
+		}
+	};
+
+	// Radial deadzone, rescaled so the output still starts at 0 outside of it
+	template<bool Enabled>
+	struct Deadzone {
+		static void apply(Frame &) {}
+	};
+	template<>
+	struct Deadzone<true> {
+		static void applyStick(short &x, short &y, float deadzone) {
+			constexpr float smax = std::numeric_limits<short>::max();
+			const float fx{ static_cast<float>(x) };
+			const float fy{ static_cast<float>(y) };
+			const float magnitude{ std::sqrt(fx * fx + fy * fy) };
+			if (magnitude <= deadzone) {
+				x = 0;
+				y = 0;
+				return;
+			}
+			const float scale{ std::min(smax, (magnitude - deadzone) * smax / (smax - deadzone)) / magnitude };
+			x = static_cast<short>(fx * scale);
+			y = static_cast<short>(fy * scale);
+		}
+		static void apply(Frame &f) {
+			XINPUT_GAMEPAD &x = f.state.xinState;
+			const float deadzone{ static_cast<float>(f.profile.stickDeadzone) };
+			applyStick(x.sThumbLX, x.sThumbLY, deadzone);
+			applyStick(x.sThumbRX, x.sThumbRY, deadzone);
+		}
+	};
+
+	// atan2 to within ~0.0015 radians using a polynomial for atan on [0, 1]
+	inline float fastAtan2(float y, float x) {
+		constexpr float pi{ 3.14159265f };
+		const float ax{ std::fabs(x) };
+		const float ay{ std::fabs(y) };
+		if (ax == 0.0f && ay == 0.0f) {
+			return 0.0f;
+		}
+		const float z{ std::min(ax, ay) / std::max(ax, ay) };
+		float angle{ (pi / 4.0f) * z - z * (z - 1.0f) * (0.2447f + 0.0663f * z) };
+		if (ay > ax) angle = pi / 2.0f - angle;
+		if (x < 0.0f) angle = pi - angle;
+		return y < 0.0f ? -angle : angle;
+	}
+
+	// Tilt steering. Low-passes every accelerometer sample and adds the
+	// controller's roll to the left stick X axis.
+	template<bool Enabled>
+	struct TiltSteering {
+		static void apply(Frame &) {}
+	};
+	template<>
+	struct TiltSteering<true> {
+		// One pole IIR at the 200Hz IMU sample rate, ~3.5Hz cutoff
+		static constexpr float alpha{ 0.1f };
+
+		static void apply(Frame &f) {
+			constexpr float smax = std::numeric_limits<short>::max();
+			TiltState &tilt = f.processing.tilt;
+			const Profile &profile = f.profile;
+
+			for (const MotionSample &m : f.report.motion()) {
+				if (!tilt.primed) {
+					tilt.gravity = { static_cast<float>(m.accel[0]), static_cast<float>(m.accel[1]), static_cast<float>(m.accel[2]) };
+					tilt.primed = true;
+					continue;
+				}
+				for (size_t axis{ 0 }; axis < 3; ++axis) {
+					tilt.gravity[axis] += alpha * (m.accel[axis] - tilt.gravity[axis]);
+				}
+			}
+
+			// Roll around the axis pointing away from the player, negative range inverts
+			const float roll{ fastAtan2(tilt.gravity[1], tilt.gravity[2]) };
+			const float magnitude{ std::fabs(roll) - profile.tiltDeadzone };
+			if (magnitude <= 0.0f) {
+				return;
+			}
+			short &x = f.state.xinState.sThumbLX;
+			x = static_cast<short>(std::clamp(x + std::copysign(magnitude, roll) * profile.tiltScale, -smax, smax));
+		}
+	};
+
+	// Flick stick. Pushing the right stick turns the camera to the direction
+	// it points, rotating it afterwards turns by the change in angle, and the
+	// gyro does the fine aim. The turn is sent as right stick deflection,
+	// relative to how fast the game turns at full deflection.
+	template<bool Enabled>
+	struct FlickStick {
+		static void apply(Frame &) {}
+	};
+	template<>
+	struct FlickStick<true> {
+		static constexpr float radiansToDegrees{ 180.0f / 3.14159265f };
+		static constexpr float gyroDegreesPerUnit{ 0.06103f }; // +-2000dps range
+
+		// Shortest signed difference between two angles
+		static float wrapDegrees(float angle) {
+			while (angle > 180.0f) angle -= 360.0f;
+			while (angle < -180.0f) angle += 360.0f;
+			return angle;
+		}
+		// Fraction of a flick done at time t, 0 to 1, eases out
+		static float flickProgress(float t) {
+			const float remaining{ 1.0f - std::clamp(t, 0.0f, 1.0f) };
+			return 1.0f - remaining * remaining;
+		}
+
+		static void apply(Frame &f) {
+			constexpr float smax = std::numeric_limits<short>::max();
+			FlickState &flick = f.processing.flick;
+			const Profile &profile = f.profile;
+			XINPUT_GAMEPAD &x = f.state.xinState;
+
+			float yaw{ 0.0f };
+			float pitch{ 0.0f };
+
+			const float stickX{ x.sThumbRX / smax };
+			const float stickY{ x.sThumbRY / smax };
+			const bool stickActive{ stickX * stickX + stickY * stickY >= profile.flickThreshold * profile.flickThreshold };
+			if (stickActive) {
+				// 0 is forward, clockwise positive
+				const float angle{ fastAtan2(stickX, stickY) * radiansToDegrees };
+				if (!flick.stickActive) {
+					// Whatever is left of the previous flick is added to this one
+					const float unfinished{ flick.flickTime < flick.flickLength
+						? flick.flickAngle * (1.0f - flickProgress(flick.flickTime / flick.flickLength)) : 0.0f };
+					flick.flickAngle = angle + unfinished;
+					flick.flickTime = 0.0f;
+					// The ease out starts at twice the average speed, stretch the
+					// flick until that fits the turn rate
+					flick.flickLength = std::max(profile.flickDuration, 2.0f * std::fabs(flick.flickAngle) / profile.cameraTurnRate);
+					yaw += flick.flickAngle * flickProgress(f.elapsed / flick.flickLength);
+				}
+				else {
+					yaw += wrapDegrees(angle - flick.lastAngle);
+				}
+				flick.lastAngle = angle;
+			}
+			if (flick.flickTime < flick.flickLength) {
+				// Continue the animation of a flick started in an earlier report
+				if (flick.stickActive || !stickActive) {
+					const float before{ flickProgress(flick.flickTime / flick.flickLength) };
+					const float after{ flickProgress((flick.flickTime + f.elapsed) / flick.flickLength) };
+					yaw += flick.flickAngle * (after - before);
+				}
+				flick.flickTime += f.elapsed;
+			}
+			flick.stickActive = stickActive;
+
+			// Average the three gyro samples, yaw around Z and pitch around Y
+			float gyroYaw{ 0.0f };
+			float gyroPitch{ 0.0f };
+			for (const MotionSample &m : f.report.motion()) {
+				gyroYaw += m.gyro[2];
+				gyroPitch += m.gyro[1];
+			}
+			const float gyroScale{ gyroDegreesPerUnit * profile.gyroSensitivity * f.elapsed / 3.0f };
+			yaw -= gyroYaw * gyroScale;
+			pitch += gyroPitch * gyroScale;
+
+			x.sThumbRX = toStick(yaw, flick.pendingYaw, f.elapsed, profile.cameraTurnRate);
+			x.sThumbRY = toStick(pitch, flick.pendingPitch, f.elapsed, profile.cameraTurnRate);
+		}
+
+		// Degrees to turn this report as stick deflection. Turn beyond full
+		// deflection is carried over into the next report, up to one more
+		// report's worth, the rest is more than the game can turn anyway.
+		static short toStick(float degrees, float &pending, float elapsed, float turnRate) {
+			constexpr float smax = std::numeric_limits<short>::max();
+			const float wanted{ degrees + pending };
+			const float reach{ turnRate * std::max(elapsed, 0.001f) };
+			const float sent{ std::clamp(wanted, -reach, reach) };
+			pending = std::clamp(wanted - sent, -reach, reach);
+			return static_cast<short>(sent / reach * smax);
+		}
+	};
+
+	// Button bytes to XInput buttons through the profile's precompiled tables
+	struct MapButtons {
+		static void apply(Frame &f) {
+			const uchar leftButtons{ f.report.leftButtons() };
+			const uchar rightButtons{ f.report.rightButtons() };
+			const uchar middleButtons{ f.report.middleButtons() };
+			const array<ButtonTable, 3> &tables = f.profile.buttons;
+			const ButtonTable &left = tables[static_cast<size_t>(ButtonSource::Left)];
+			const ButtonTable &right = tables[static_cast<size_t>(ButtonSource::Right)];
+			const ButtonTable &middle = tables[static_cast<size_t>(ButtonSource::Middle)];
+
+			ExpandedPadState &state = f.state;
+			state.xinState.wButtons = left.buttons[leftButtons] | right.buttons[rightButtons] | middle.buttons[middleButtons];
+			const uchar extras = left.extras[leftButtons] | right.extras[rightButtons] | middle.extras[middleButtons];
+			if (extras & ButtonTable::LeftTrigger)
+				state.xinState.bLeftTrigger = std::numeric_limits<BYTE>::max();
+			if (extras & ButtonTable::RightTrigger)
+				state.xinState.bRightTrigger = std::numeric_limits<BYTE>::max();
+			state.sharePressed = (extras & ButtonTable::Share) != 0;
+
+#ifdef _DEBUG
+			printButtons(leftButtons, ButtonSource::Left);
+			printButtons(rightButtons, ButtonSource::Right);
+			printButtons(middleButtons, ButtonSource::Middle);
+#endif
+		}
+#ifdef _DEBUG
+		static void printButtons(uchar c, ButtonSource src) {
+			const array<Button, 8>& map = getButtonMap(src);
+			for (uchar i{ 0 }; i < 8; ++i) {
+				if (map[i] != Button::None && (c & (1 << i)) != 0)
+					std::cout << buttonToString(map[i]) << ' ';
+			}
+		}
+#endif
+	};
+
+	// Motion gestures bound to buttons, detected incrementally on every IMU
+	// sample: shake from the running energy of the accelerometer over a fixed
+	// window, flick up from a peak in the pitch rate, tilt hold from the roll
+	// of the low-passed gravity vector. Runs after MapButtons and ORs into it.
+	template<bool Enabled>
+	struct Gestures {
+		static void apply(Frame &) {}
+	};
+	template<>
+	struct Gestures<true> {
+		static constexpr float alpha{ 0.05f }; // Gravity low-pass, ~1.6Hz at 200Hz
+		static constexpr float flickUpHoldTime{ 0.1f }; // Long enough for games polling slowly to see it
+		static constexpr float flickDownRebound{ 0.2f }; // Seconds a downwards flick's bounce back can look like a flick up
+
+		static void apply(Frame &f) {
+			GestureState &g = f.processing.gestures;
+			const Profile &profile = f.profile;
+			const float sampleTime{ f.elapsed / 3.0f };
+
+			for (const MotionSample &m : f.report.motion()) {
+				if (!g.primed) {
+					g.gravity = { static_cast<float>(m.accel[0]), static_cast<float>(m.accel[1]), static_cast<float>(m.accel[2]) };
+					g.sinceFlickDown = flickDownRebound;
+					g.primed = true;
+				}
+				float energy{ 0.0f };
+				for (size_t axis{ 0 }; axis < 3; ++axis) {
+					const float deviation{ m.accel[axis] - g.gravity[axis] };
+					g.gravity[axis] += alpha * deviation;
+					energy += deviation * deviation;
+				}
+				g.shakeSum += energy - g.shakeEnergy[g.shakeIndex];
+				g.shakeEnergy[g.shakeIndex] = energy;
+				g.shakeIndex = (g.shakeIndex + 1) % shakeWindow;
+				if (g.shakeIndex == 0) {
+					// Resummed once per window, float rounding in the running sum would otherwise build up
+					g.shakeSum = std::accumulate(g.shakeEnergy.begin(), g.shakeEnergy.end(), 0.0f);
+				}
+
+				// Fire on the sample after the peak of an upwards rotation. Stopping a
+				// downwards flick swings back up, that doesn't count.
+				const float pitchRate{ static_cast<float>(m.gyro[1]) };
+				g.sinceFlickDown = pitchRate < -profile.flickUpThreshold ? 0.0f : std::min(g.sinceFlickDown + sampleTime, 1.0f);
+				if (g.pitchRising && pitchRate < g.lastPitchRate && g.lastPitchRate > profile.flickUpThreshold
+					&& g.sinceFlickDown > flickDownRebound) {
+					g.flickUpHeld = flickUpHoldTime;
+				}
+				g.pitchRising = pitchRate > g.lastPitchRate;
+				g.lastPitchRate = pitchRate;
+			}
+
+			unsigned short buttons{ 0 };
+			if (g.shakeSum / shakeWindow > profile.shakeThreshold) {
+				buttons |= profile.shakeButtons;
+			}
+			if (g.flickUpHeld > 0.0f) {
+				buttons |= profile.flickUpButtons;
+				g.flickUpHeld -= f.elapsed;
+			}
+
+			const float roll{ fastAtan2(g.gravity[1], g.gravity[2]) };
+			g.tiltLeftTime = roll < -profile.tiltHoldAngle ? g.tiltLeftTime + f.elapsed : 0.0f;
+			g.tiltRightTime = roll > profile.tiltHoldAngle ? g.tiltRightTime + f.elapsed : 0.0f;
+			if (g.tiltLeftTime >= profile.tiltHoldTime) {
+				buttons |= profile.tiltLeftButtons;
+			}
+			if (g.tiltRightTime >= profile.tiltHoldTime) {
+				buttons |= profile.tiltRightButtons;
+			}
+
+			f.state.xinState.wButtons |= buttons;
+		}
+	};
+
+	template<class... Stages>
+	struct Pipeline {
+		static void run(Frame &f) {
+			(Stages::apply(f), ...);
+		}
+	};
+
+	template<bool UseGateCorrection, bool UseDeadzone, bool UseTiltSteering, bool UseFlickStick, bool UseGestures>
+	struct StandardPipeline : Pipeline<
+		CalibrateSticks,
+		GateCorrection<UseGateCorrection>,
+		Deadzone<UseDeadzone>,
+		TiltSteering<UseTiltSteering>,
+		FlickStick<UseFlickStick>,
+		MapButtons,
+		Gestures<UseGestures>
+	> {};
+
+	// StandardPipeline specialization for each index of pipelines
+	template<size_t... Index>
+	constexpr std::array<ProcessFunc, sizeof...(Index)> makePipelines(std::index_sequence<Index...>) {
+		return { &StandardPipeline<(Index & 0x1) != 0, (Index & 0x2) != 0, (Index & 0x4) != 0, (Index & 0x8) != 0, (Index & 0x10) != 0>::run... };
+	}
+
+	constexpr uchar pipelineIndex(bool gate, bool deadzone, bool tilt, bool flick, bool gestures) {
+		return static_cast<uchar>((gate ? 0x1 : 0) | (deadzone ? 0x2 : 0) | (tilt ? 0x4 : 0) | (flick ? 0x8 : 0) | (gestures ? 0x10 : 0));
+	}
+
+	const std::string buttonConfigName{ "bMatchButtonLabels" };
+	const std::string deadzoneConfigName{ "iStickDeadzone" };
+	const std::string rangePercentileConfigName{ "fStickRangePercentile" };
+	const std::string rangeHalfLifeConfigName{ "fStickRangeHalfLife" };
+	const std::string gateConfigName{ "bGateCorrection" };
+	const std::string tiltConfigName{ "bTiltSteering" };
+	const std::string tiltRangeConfigName{ "fTiltRange" };
+	const std::string tiltDeadzoneConfigName{ "fTiltDeadzone" };
+
+	const std::string flickConfigName{ "bFlickStick" };
+	const std::string flickThresholdConfigName{ "fFlickThreshold" };
+	const std::string flickTimeConfigName{ "fFlickTime" };
+	const std::string turnRateConfigName{ "fCameraTurnRate" };
+	const std::string gyroSensitivityConfigName{ "fGyroSensitivity" };
+
+	const std::string shakeButtonConfigName{ "sShakeButton" };
+	const std::string flickUpButtonConfigName{ "sFlickUpButton" };
+	const std::string tiltLeftButtonConfigName{ "sTiltLeftButton" };
+	const std::string tiltRightButtonConfigName{ "sTiltRightButton" };
+	const std::string shakeThresholdConfigName{ "fShakeThreshold" };
+	const std::string flickUpThresholdConfigName{ "fFlickUpThreshold" };
+	const std::string tiltHoldAngleConfigName{ "fTiltHoldAngle" };
+	const std::string tiltHoldTimeConfigName{ "fTiltHoldTime" };
+
+	constexpr float defaultRangePercentile{ 0.5f };
+	constexpr float defaultRangeHalfLife{ 60.0f };
+	constexpr float defaultTiltRange{ 45.0f };
+	constexpr float defaultTiltDeadzone{ 3.0f };
+	constexpr float defaultFlickThreshold{ 0.9f };
+	constexpr float defaultFlickTime{ 0.1f };
+	constexpr float defaultTurnRate{ 360.0f };
+	constexpr float defaultGyroSensitivity{ 1.0f };
+	constexpr float defaultShakeThreshold{ 0.8f };
+	constexpr float defaultFlickUpThreshold{ 400.0f };
+	constexpr float defaultTiltHoldAngle{ 30.0f };
+	constexpr float defaultTiltHoldTime{ 0.3f };
+	constexpr float accelUnitsPerG{ 4096.0f }; // +-8G range
+	constexpr float gyroUnitsPerDegree{ 16.384f }; // +-2000dps range
+
+	// XInput button names for gesture bindings
+	const std::unordered_map<std::string, unsigned short> xinputButtonNames{
+		{ "Up", 0x0001 },
+		{ "Down", 0x0002 },
+		{ "Left", 0x0004 },
+		{ "Right", 0x0008 },
+		{ "Start", 0x0010 },
+		{ "Back", 0x0020 },
+		{ "LS", 0x0040 },
+		{ "RS", 0x0080 },
+		{ "LB", 0x0100 },
+		{ "RB", 0x0200 },
+		{ "Guide", 0x0400 },
+		{ "A", 0x1000 },
+		{ "B", 0x2000 },
+		{ "X", 0x4000 },
+		{ "Y", 0x8000 }
+	};
+
+	unsigned short getButtonBinding(const std::string &name, const std::string &scope) {
+		const std::optional<std::string> value{ Config::get<std::string>(name, scope) };
+		if (!value || *value == "None") {
+			return 0;
+		}
+		auto it = xinputButtonNames.find(*value);
+		if (it == xinputButtonNames.end()) {
+			throw ConfigError(name + " is not an XInput button name: " + *value);
+		}
+		return it->second;
+	}
+
+	constexpr float degreesToRadians(float degrees) {
+		return degrees * 3.14159265f / 180.0f;
+	}
+
+	ButtonTable buildButtonTable(ButtonSource src, bool matchLabels) {
+		const array<Button, 8>& map = getButtonMap(src);
+		ButtonTable table{};
+		for (size_t value{ 0 }; value < 256; ++value) {
+			for (uchar i{ 0 }; i < 8; ++i) {
+				if ((value & (1 << i)) == 0) continue;
+				switch (map[i]) {
+				case Button::LZ:
+					table.extras[value] |= ButtonTable::LeftTrigger;
+					break;
+				case Button::RZ:
+					table.extras[value] |= ButtonTable::RightTrigger;
+					break;
+				case Button::Share:
+					table.extras[value] |= ButtonTable::Share;
+					break;
+				default:
+					table.buttons[value] |= matchLabels ? buttonToReportBitsOld(map[i]) : buttonToReportBits(map[i]);
+					break;
+				}
+			}
+		}
+		return table;
+	}
+
+}; // namespace
+
+namespace Procon {
+
+	const std::array<ProcessFunc, pipelineCount> pipelines{ makePipelines(std::make_index_sequence<pipelineCount>{}) };
+
+	bool validateReport(const uchar *report, size_t length) {
+		if (length < usbInputLayout.length) {
+			return false;
+		}
+		uint32_t header;
+		uint64_t status;
+		std::memcpy(&header, report, sizeof(header));
+		std::memcpy(&status, report + statusWindow, sizeof(status));
+		return (header & headerMask) == headerBits && (status & statusMask) == statusBits;
+	}
+
+	Profile compileProfile(const std::string &scope) {
+		const bool matchLabels{ Config::get<bool>(buttonConfigName, scope).value_or(false) };
+		const int deadzone{ std::clamp<int32_t>(Config::get<int32_t>(deadzoneConfigName, scope).value_or(0), 0, std::numeric_limits<short>::max() - 1) };
+
+		Profile profile{};
+		const std::string name{ scope.empty() ? "default" : scope.substr(0, scope.size() - 1) };
+		name.copy(profile.name.data(), profile.name.size() - 1);
+		profile.stickDeadzone = static_cast<short>(deadzone);
+		profile.gateCorrection = Config::get<bool>(gateConfigName, scope).value_or(false);
+		profile.rangePercentile = std::clamp(Config::get<float>(rangePercentileConfigName, scope).value_or(defaultRangePercentile), 0.0f, 10.0f) / 100.0f;
+		const float halfLife{ std::max(1.0f, Config::get<float>(rangeHalfLifeConfigName, scope).value_or(defaultRangeHalfLife)) };
+		profile.rangeFadeRate = 1.0f / halfLife;
+		profile.buttons[static_cast<size_t>(ButtonSource::Left)] = buildButtonTable(ButtonSource::Left, matchLabels);
+		profile.buttons[static_cast<size_t>(ButtonSource::Right)] = buildButtonTable(ButtonSource::Right, matchLabels);
+		profile.buttons[static_cast<size_t>(ButtonSource::Middle)] = buildButtonTable(ButtonSource::Middle, matchLabels);
+		profile.tiltSteering = Config::get<bool>(tiltConfigName, scope).value_or(false);
+		profile.tiltDeadzone = degreesToRadians(std::max(0.0f, Config::get<float>(tiltDeadzoneConfigName, scope).value_or(defaultTiltDeadzone)));
+		const float tiltRange{ degreesToRadians(Config::get<float>(tiltRangeConfigName, scope).value_or(defaultTiltRange)) };
+		// Keep at least a degree between the deadzone and full lock
+		const float tiltTravel{ std::max(std::fabs(tiltRange) - profile.tiltDeadzone, degreesToRadians(1.0f)) };
+		profile.tiltScale = std::copysign(std::numeric_limits<short>::max() / tiltTravel, tiltRange);
+		profile.flickStick = Config::get<bool>(flickConfigName, scope).value_or(false);
+		profile.flickThreshold = std::clamp(Config::get<float>(flickThresholdConfigName, scope).value_or(defaultFlickThreshold), 0.1f, 1.0f);
+		profile.flickDuration = std::max(0.001f, Config::get<float>(flickTimeConfigName, scope).value_or(defaultFlickTime));
+		profile.cameraTurnRate = std::max(1.0f, Config::get<float>(turnRateConfigName, scope).value_or(defaultTurnRate));
+		profile.gyroSensitivity = Config::get<float>(gyroSensitivityConfigName, scope).value_or(defaultGyroSensitivity);
+		profile.shakeButtons = getButtonBinding(shakeButtonConfigName, scope);
+		profile.flickUpButtons = getButtonBinding(flickUpButtonConfigName, scope);
+		profile.tiltLeftButtons = getButtonBinding(tiltLeftButtonConfigName, scope);
+		profile.tiltRightButtons = getButtonBinding(tiltRightButtonConfigName, scope);
+		profile.gestures = (profile.shakeButtons | profile.flickUpButtons | profile.tiltLeftButtons | profile.tiltRightButtons) != 0;
+		const float shakeThreshold{ Config::get<float>(shakeThresholdConfigName, scope).value_or(defaultShakeThreshold) * accelUnitsPerG };
+		profile.shakeThreshold = shakeThreshold * shakeThreshold;
+		// Upwards is positive, a negative setting would fire on any motion
+		profile.flickUpThreshold = std::fabs(Config::get<float>(flickUpThresholdConfigName, scope).value_or(defaultFlickUpThreshold)) * gyroUnitsPerDegree;
+		profile.tiltHoldAngle = degreesToRadians(Config::get<float>(tiltHoldAngleConfigName, scope).value_or(defaultTiltHoldAngle));
+		profile.tiltHoldTime = Config::get<float>(tiltHoldTimeConfigName, scope).value_or(defaultTiltHoldTime);
+		profile.pipeline = pipelineIndex(profile.gateCorrection, deadzone != 0, profile.tiltSteering, profile.flickStick, profile.gestures);
+		return profile;
+	}
+
+};
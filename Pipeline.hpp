@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <type_traits>
+
+#include "Common.hpp"
+
+namespace Procon {
+
+	struct ExpandedPadState;
+	struct CalibrationData;
+	struct Profile;
+	class ReportView;
+
+	// Low-passed accelerometer, what tilt steering reads the roll from
+	struct TiltState {
+		std::array<float, 3> gravity;
+		bool primed;
+	};
+
+	// Flick stick camera, angles in degrees
+	struct FlickState {
+		bool stickActive; // Right stick was past the flick threshold last report
+		float lastAngle;
+		float flickAngle; // Total turn of the flick being animated
+		float flickTime; // Seconds since the flick started
+		float flickLength; // Seconds the flick is animated over, at least fFlickTime
+		float pendingYaw; // Turn that didn't fit in the last report's stick range, at most one report's worth
+		float pendingPitch;
+	};
+
+	// Motion gesture detection, fixed-size so it never allocates
+	constexpr size_t shakeWindow{ 32 }; // IMU samples, 160ms
+	struct GestureState {
+		std::array<float, 3> gravity; // Low-passed accelerometer
+		bool primed;
+		std::array<float, shakeWindow> shakeEnergy; // Ring of squared accel deviation
+		size_t shakeIndex;
+		float shakeSum; // Running sum of shakeEnergy
+		float lastPitchRate;
+		bool pitchRising;
+		float sinceFlickDown; // Seconds since the pitch rate last passed the flick threshold downwards
+		float flickUpHeld; // Seconds left to hold the flick up button
+		float tiltLeftTime; // Seconds the controller has been tilted left
+		float tiltRightTime;
+	};
+
+	// Decaying histogram of one stick axis. Each sample adds increment to its
+	// bin, and increment grows with the time between reports, so older samples
+	// count for exponentially less without touching every bin each report.
+	constexpr size_t rangeBins{ 128 }; // 2 raw stick units each
+	struct AxisHistogram {
+		std::array<float, rangeBins> counts;
+		float increment{ 1.0f };
+	};
+	// Stick range estimation, left x, left y, right x, right y
+	struct RangeState {
+		std::array<AxisHistogram, 4> axes;
+		unsigned int sinceUpdate; // Reports since the percentiles were last read
+	};
+
+	// Per-controller state the optional stages keep between reports
+	struct ProcessingState {
+		RangeState range;
+		TiltState tilt;
+		FlickState flick;
+		GestureState gestures;
+	};
+
+	// Everything a processing stage may read or write for one report
+	struct Frame {
+		ReportView &report; // Decodes report fields as stages ask for them
+		float elapsed; // Seconds since the previous report
+		const Profile &profile;
+		CalibrationData &calib;
+		ProcessingState &processing;
+		ExpandedPadState &state;
+	};
+
+	// A fully inlined calibrate -> filter -> map pipeline
+	using ProcessFunc = void(*)(Frame &frame);
+
+	// Every StandardPipeline specialization, indexed by a bit per optional
+	// stage: gate correction, deadzone, tilt, flick stick, gestures
+	constexpr size_t pipelineCount{ 32 };
+	extern const std::array<ProcessFunc, pipelineCount> pipelines;
+
+	// XInput output for every possible value of one report button byte
+	struct ButtonTable {
+		enum Extra : uchar {
+			LeftTrigger = 0x1,
+			RightTrigger = 0x2,
+			Share = 0x4
+		};
+		std::array<unsigned short, 256> buttons;
+		std::array<uchar, 256> extras;
+	};
+
+	// Mapping settings precompiled from the config into lookup tables and a
+	// pipeline specialization, so nothing is looked up by name per report.
+	// Holds no pointers, so compiled profiles can be stored in a file and
+	// used straight from a mapping of it.
+	constexpr size_t profileNameLen{ 32 };
+	struct Profile {
+		std::array<char, profileNameLen> name; // Null terminated
+		uchar pipeline; // Index into pipelines
+		std::array<ButtonTable, 3> buttons; // Indexed by ButtonSource
+		float rangePercentile; // Fraction of each side's stick samples ignored as outliers
+		float rangeFadeRate; // Histogram increment doublings per second, sets how fast old samples fade
+		short stickDeadzone; // 0 disables, the pipeline without a deadzone stage is used
+		bool gateCorrection;
+		bool tiltSteering;
+		float tiltScale; // Stick units per radian of roll past the deadzone, negative inverts
+		float tiltDeadzone; // Roll in radians ignored around level
+		bool flickStick;
+		float flickThreshold; // Right stick deflection, 0 to 1, that counts as a flick
+		float flickDuration; // Seconds a flick is spread over
+		float cameraTurnRate; // Degrees per second the game turns at full right stick
+		float gyroSensitivity; // Camera degrees per degree the controller turns
+		bool gestures; // Any gesture has a button bound
+		unsigned short shakeButtons; // XInput buttons pressed by each gesture, 0 is unbound
+		unsigned short flickUpButtons;
+		unsigned short tiltLeftButtons;
+		unsigned short tiltRightButtons;
+		float shakeThreshold; // Mean squared accel deviation in raw units
+		float flickUpThreshold; // Raw gyro pitch rate
+		float tiltHoldAngle; // Radians of roll
+		float tiltHoldTime; // Seconds
+
+		void process(Frame &frame) const {
+			pipelines[pipeline](frame);
+		}
+	};
+	static_assert(std::is_trivially_copyable_v<Profile> && std::is_standard_layout_v<Profile>, "Profiles are stored as raw bytes");
+
+	// Cheap check of a USB reply before decoding: enough bytes were read, it
+	// holds a full input report, and no reserved button bits are set
+	bool validateReport(const uchar *report, size_t length);
+
+	// Builds a Profile from the currently loaded Config, values in the scope
+	// override the unscoped ones
+	Profile compileProfile(const std::string &scope = "");
+
+};
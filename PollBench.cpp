@@ -0,0 +1,104 @@
+#include "PollBench.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "Config.hpp"
+#include "Controller.hpp"
+#include "SimulatedReply.hpp"
+
+namespace {
+	using namespace Procon;
+	using clock = Controller::clock;
+
+	constexpr size_t maxThreads{ 4 };
+	constexpr auto runTime = std::chrono::milliseconds(500);
+
+	void poll(Controller &controller, const std::atomic<bool> &start, const std::atomic<bool> &stop, size_t &reports) {
+		std::array<uchar, exchangeLen> reply{ simulatedReply() };
+		while (!start.load(std::memory_order_acquire)) {
+			std::this_thread::yield();
+		}
+		size_t count{ 0 };
+		while (!stop.load(std::memory_order_relaxed)) {
+			++reply[11];
+			reply[13] = (count & 0x40) != 0 ? 0x08 : 0x00;
+			controller.decodeReport(reply.data(), reply.size(), clock::now());
+			++count;
+		}
+		reports = count;
+	}
+
+	// Reports per second per thread with threadCount controllers polled at once
+	double measure(size_t threadCount) {
+		std::vector<Controller> controllers;
+		controllers.reserve(threadCount);
+		for (size_t i{ 0 }; i < threadCount; ++i) {
+			controllers.emplace_back(static_cast<uchar>(i));
+		}
+		std::array<size_t, maxThreads> reports{};
+		std::atomic<bool> start{ false };
+		std::atomic<bool> stop{ false };
+		std::vector<std::thread> threads;
+		for (size_t i{ 0 }; i < threadCount; ++i) {
+			threads.emplace_back(poll, std::ref(controllers[i]), std::cref(start), std::cref(stop), std::ref(reports[i]));
+		}
+		// Reads published state the way the main loop's centering pass does
+		for (Controller &c : controllers) {
+			c.addStateReader();
+		}
+		std::thread reader{ [&controllers, &start, &stop] {
+			while (!start.load(std::memory_order_acquire)) {
+				std::this_thread::yield();
+			}
+			while (!stop.load(std::memory_order_relaxed)) {
+				for (const Controller &c : controllers) {
+					static_cast<void>(c.getState());
+				}
+			}
+		} };
+
+		start.store(true, std::memory_order_release);
+		std::this_thread::sleep_for(runTime);
+		stop.store(true, std::memory_order_relaxed);
+		for (std::thread &t : threads) {
+			t.join();
+		}
+		reader.join();
+
+		size_t total{ 0 };
+		for (size_t i{ 0 }; i < threadCount; ++i) {
+			total += reports[i];
+		}
+		return total / std::chrono::duration<double>(runTime).count() / threadCount;
+	}
+};
+
+namespace Procon {
+
+	int runPollBench(std::ostream &out) {
+		try {
+			out << "Controller is " << sizeof(Controller) << " bytes, aligned to " << alignof(Controller) << "\n";
+			const double single{ measure(1) };
+			out << "1 thread: " << static_cast<size_t>(single) << " reports/s\n";
+			for (size_t threads{ 2 }; threads <= maxThreads; ++threads) {
+				const double rate{ measure(threads) };
+				out << threads << " threads: " << static_cast<size_t>(rate) << " reports/s per thread, "
+					<< static_cast<int>(rate / single * 100.0) << "% of 1 thread\n";
+			}
+		}
+		catch (ControllerException &e) {
+			out << "ControllerException: " << e.what() << '\n';
+			return -1;
+		}
+		catch (const ConfigError &e) {
+			out << "Error in config file: " << e.what() << '\n';
+			return -1;
+		}
+		return 0;
+	}
+
+};
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <ostream>
+
+namespace Procon {
+
+	// Benchmark for the Controller memory layout, run with --poll-bench.
+	// Decodes simulated reports on one thread per controller, with the
+	// controllers side by side in a vector as main() keeps them, while another
+	// thread reads their published state, and prints how the per-thread rate
+	// holds up as threads are added. Only meaningful with at least as many
+	// cores as threads. Needs no hardware or ScpVBus. Returns non-zero on failure.
+	int runPollBench(std::ostream &out);
+
+};
@@ -0,0 +1,167 @@
+#include "ProfileStore.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+namespace {
+	using namespace Procon;
+
+	constexpr uint64_t fnvOffset{ 0xcbf29ce484222325ull };
+	constexpr uint64_t fnvPrime{ 0x100000001b3ull };
+	constexpr uint32_t sectionAlign{ 64 };
+
+	constexpr uint32_t alignUp(uint32_t offset) {
+		return (offset + sectionAlign - 1) / sectionAlign * sectionAlign;
+	}
+
+	// Every section inside the file and aligned for its type
+	bool validLayout(const ProfileStoreHeader &h, uint64_t size) {
+		const uint64_t profilesEnd{ h.profilesOffset + static_cast<uint64_t>(h.profileCount) * sizeof(Profile) };
+		const uint64_t appsEnd{ h.appsOffset + static_cast<uint64_t>(h.appCount) * sizeof(ProfileApp) };
+		return h.profileCount > 0
+			&& h.profilesOffset % alignof(Profile) == 0 && h.appsOffset % alignof(ProfileApp) == 0
+			&& h.profilesOffset >= sizeof(ProfileStoreHeader) && profilesEnd <= size
+			&& h.appsOffset >= profilesEnd && appsEnd <= size;
+	}
+};
+
+namespace Procon {
+
+	ProfileStore::ProfileStore(ProfileStore &&other) noexcept {
+		*this = std::move(other);
+	}
+
+	ProfileStore& ProfileStore::operator=(ProfileStore &&other) noexcept {
+		if (this != &other) {
+			release();
+			file = std::exchange(other.file, INVALID_HANDLE_VALUE);
+			mapping = std::exchange(other.mapping, nullptr);
+			view = std::exchange(other.view, nullptr);
+			header = std::exchange(other.header, nullptr);
+		}
+		return *this;
+	}
+
+	ProfileStore::~ProfileStore() {
+		release();
+	}
+
+	void ProfileStore::release() {
+		header = nullptr;
+		if (view != nullptr) {
+			UnmapViewOfFile(view);
+			view = nullptr;
+		}
+		if (mapping != nullptr) {
+			CloseHandle(mapping);
+			mapping = nullptr;
+		}
+		if (file != INVALID_HANDLE_VALUE) {
+			CloseHandle(file);
+			file = INVALID_HANDLE_VALUE;
+		}
+	}
+
+	ProfileStore ProfileStore::open(const std::string &fileName, uint64_t sourceHash) {
+		ProfileStore store;
+		store.file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (store.file == INVALID_HANDLE_VALUE) {
+			return store;
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(store.file, &size) || size.QuadPart < static_cast<LONGLONG>(sizeof(ProfileStoreHeader))) {
+			store.release();
+			return store;
+		}
+		store.mapping = CreateFileMappingA(store.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (store.mapping == nullptr) {
+			store.release();
+			return store;
+		}
+		store.view = static_cast<const uchar*>(MapViewOfFile(store.mapping, FILE_MAP_READ, 0, 0, 0));
+		if (store.view == nullptr) {
+			store.release();
+			return store;
+		}
+		const ProfileStoreHeader *h = reinterpret_cast<const ProfileStoreHeader*>(store.view);
+		if (h->magic != profileStoreMagic || h->version != profileStoreVersion || h->profileSize != sizeof(Profile)
+			|| h->sourceHash != sourceHash || !validLayout(*h, static_cast<uint64_t>(size.QuadPart))) {
+			store.release();
+			return store;
+		}
+		// A damaged pipeline index would jump anywhere, that much is checked
+		const Profile *profiles = reinterpret_cast<const Profile*>(store.view + h->profilesOffset);
+		const ProfileApp *apps = reinterpret_cast<const ProfileApp*>(store.view + h->appsOffset);
+		for (uint32_t i{ 0 }; i < h->profileCount; ++i) {
+			if (profiles[i].pipeline >= pipelineCount) {
+				store.release();
+				return store;
+			}
+		}
+		for (uint32_t i{ 0 }; i < h->appCount; ++i) {
+			if (apps[i].profile >= h->profileCount) {
+				store.release();
+				return store;
+			}
+		}
+		store.header = h;
+		return store;
+	}
+
+	bool ProfileStore::write(const std::string &fileName, uint64_t sourceHash, const std::vector<Profile> &profiles, const std::vector<ProfileApp> &apps) {
+		ProfileStoreHeader h{};
+		h.magic = profileStoreMagic;
+		h.version = profileStoreVersion;
+		h.profileSize = sizeof(Profile);
+		h.profileCount = static_cast<uint32_t>(profiles.size());
+		h.profilesOffset = alignUp(sizeof(ProfileStoreHeader));
+		h.appCount = static_cast<uint32_t>(apps.size());
+		h.appsOffset = alignUp(h.profilesOffset + h.profileCount * static_cast<uint32_t>(sizeof(Profile)));
+		h.sourceHash = sourceHash;
+
+		std::vector<char> bytes(h.appsOffset + apps.size() * sizeof(ProfileApp), 0);
+		std::memcpy(bytes.data(), &h, sizeof(h));
+		std::memcpy(bytes.data() + h.profilesOffset, profiles.data(), profiles.size() * sizeof(Profile));
+		// No programs is common, and memcpy from an empty vector's data() is undefined
+		if (!apps.empty()) {
+			std::memcpy(bytes.data() + h.appsOffset, apps.data(), apps.size() * sizeof(ProfileApp));
+		}
+
+		std::ofstream out{ fileName, std::ios::binary | std::ios::trunc };
+		out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+		return out.good();
+	}
+
+	bool ProfileStore::empty() const {
+		return header == nullptr;
+	}
+
+	std::span<const Profile> ProfileStore::profiles() const {
+		if (header == nullptr) {
+			return {};
+		}
+		return { reinterpret_cast<const Profile*>(view + header->profilesOffset), header->profileCount };
+	}
+
+	std::span<const ProfileApp> ProfileStore::apps() const {
+		if (header == nullptr) {
+			return {};
+		}
+		return { reinterpret_cast<const ProfileApp*>(view + header->appsOffset), header->appCount };
+	}
+
+	uint64_t hashSources(const std::vector<std::string> &files) {
+		uint64_t hash{ fnvOffset };
+		for (const std::string &name : files) {
+			std::ifstream in{ name, std::ios::binary };
+			for (std::istreambuf_iterator<char> it{ in }, end; it != end; ++it) {
+				hash = (hash ^ static_cast<uchar>(*it)) * fnvPrime;
+			}
+			hash = (hash ^ 0xFF) * fnvPrime; // Keeps moving text between files from hashing the same
+		}
+		return hash;
+	}
+
+};
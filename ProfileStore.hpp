@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+
+#include "Pipeline.hpp"
+
+namespace Procon {
+
+	constexpr std::array<char, 4> profileStoreMagic{ 'P', 'X', 'P', 'S' };
+	constexpr uint32_t profileStoreVersion{ 3 }; // Bump when compileProfile() output changes
+	constexpr size_t programNameLen{ 64 };
+
+	// Which profile a program gets
+	struct ProfileApp {
+		std::array<char, programNameLen> program; // Lowercase file name, null terminated
+		uint32_t profile; // Index into the store's profiles
+	};
+
+	// Start of a profile store file. Offsets are from the start of the file,
+	// nothing in the file is a pointer, so it works wherever it's mapped.
+	struct ProfileStoreHeader {
+		std::array<char, 4> magic;
+		uint32_t version;
+		uint32_t profileSize; // sizeof(Profile) when written, any layout change invalidates the file
+		uint32_t profileCount; // The first profile is the default one
+		uint32_t profilesOffset;
+		uint32_t appCount;
+		uint32_t appsOffset;
+		uint32_t reserved;
+		uint64_t sourceHash; // hashSources() of the text files the profiles were compiled from
+	};
+
+	// Compiled profiles read from sProfileStore through a read-only file
+	// mapping. The profiles and their lookup tables are used in place, loading
+	// is a header check, no parsing and no copying.
+	class ProfileStore {
+	public:
+		ProfileStore() = default;
+		ProfileStore(ProfileStore &&other) noexcept;
+		ProfileStore& operator=(ProfileStore &&other) noexcept;
+		ProfileStore(const ProfileStore&) = delete;
+		ProfileStore& operator=(const ProfileStore&) = delete;
+		~ProfileStore();
+
+		// Maps file. The store is empty if the file is missing, damaged, from
+		// another version, or wasn't compiled from sources hashing to sourceHash.
+		static ProfileStore open(const std::string &file, uint64_t sourceHash);
+		// Writes profiles and apps to file, returns false if it couldn't
+		static bool write(const std::string &file, uint64_t sourceHash, const std::vector<Profile> &profiles, const std::vector<ProfileApp> &apps);
+
+		bool empty() const;
+		std::span<const Profile> profiles() const;
+		std::span<const ProfileApp> apps() const;
+
+	private:
+		void release();
+
+		HANDLE file{ INVALID_HANDLE_VALUE };
+		HANDLE mapping{ nullptr };
+		const uchar *view{ nullptr };
+		const ProfileStoreHeader *header{ nullptr };
+	};
+
+	// FNV-1a over the bytes of every file in order, missing files hash as empty
+	uint64_t hashSources(const std::vector<std::string> &files);
+
+};
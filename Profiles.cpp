@@ -0,0 +1,209 @@
+#include "Profiles.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+
+#include "Config.hpp"
+#include "ProfileStore.hpp"
+
+namespace {
+	using namespace Procon;
+
+	const std::string profilesName{ "sProfiles" };
+	const std::string profileAppsName{ "sProfileApps" };
+	const std::string checkIntervalName{ "iProfileCheckIntervalMs" };
+	const std::string profileStoreName{ "sProfileStore" };
+	const std::string configFile{ "config.txt" };
+	const std::string defaultProfileStore{ "profiles.bin" };
+	constexpr int defaultCheckInterval{ 500 };
+
+	// Profiles live until exit so the active pointer never dangles. They're
+	// used from the store's mapping, or from compiled if there's no store.
+	ProfileStore store;
+	std::vector<Profile> compiled;
+	std::unordered_map<std::string, const Profile*> byProgram;
+	const Profile *defaultProfile{ nullptr };
+	std::atomic<const Profile*> current{ nullptr };
+	std::once_flag loaded;
+
+	std::atomic<bool> watching{ false };
+	std::thread watcher;
+
+	std::string lowercase(std::string s) {
+		std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return s;
+	}
+
+	std::vector<std::string> splitList(const std::string &list) {
+		std::vector<std::string> out;
+		std::stringstream s{ list };
+		std::string item;
+		while (std::getline(s, item, ',')) {
+			if (!item.empty())
+				out.push_back(item);
+		}
+		return out;
+	}
+
+	// Compiles the default profile and every profile file, the default one first
+	void compileProfiles(const std::vector<std::string> &files, std::vector<Profile> &profiles, std::vector<ProfileApp> &apps) {
+		profiles.push_back(compileProfile());
+		for (const std::string &file : files) {
+			const std::string scope{ file + '.' };
+			Config::readConfigFile(file, scope);
+			const std::optional<std::string> list{ Config::get<std::string>(scope + profileAppsName) };
+			if (!list) {
+				throw ConfigError("Profile " + file + " has no " + profileAppsName);
+			}
+			profiles.push_back(compileProfile(scope));
+			for (const std::string &app : splitList(*list)) {
+				if (app.size() >= programNameLen) {
+					throw ConfigError("Program name in " + file + " is too long: " + app);
+				}
+				ProfileApp entry{};
+				lowercase(app).copy(entry.program.data(), entry.program.size() - 1);
+				entry.profile = static_cast<uint32_t>(profiles.size() - 1);
+				apps.push_back(entry);
+			}
+		}
+	}
+
+	void loadProfiles() {
+		const std::vector<std::string> files{ splitList(Config::get<std::string>(profilesName).value_or("")) };
+		const std::string storeFile{ Config::get<std::string>(profileStoreName).value_or(defaultProfileStore) };
+		const bool useStore{ !storeFile.empty() && storeFile != "None" };
+
+		std::vector<std::string> sources{ configFile };
+		sources.insert(sources.end(), files.begin(), files.end());
+		const uint64_t sourceHash{ useStore ? hashSources(sources) : 0 };
+		if (useStore) {
+			store = ProfileStore::open(storeFile, sourceHash);
+		}
+		if (store.empty()) {
+			// No store or the text changed, compile and store for next time
+			std::vector<ProfileApp> apps;
+			compileProfiles(files, compiled, apps);
+			if (useStore && ProfileStore::write(storeFile, sourceHash, compiled, apps)) {
+				store = ProfileStore::open(storeFile, sourceHash);
+			}
+			if (store.empty()) {
+				for (const ProfileApp &app : apps) {
+					byProgram[app.program.data()] = &compiled[app.profile];
+				}
+				defaultProfile = &compiled.front();
+				current.store(defaultProfile, std::memory_order_release);
+				return;
+			}
+			compiled.clear();
+		}
+
+		const std::span<const Profile> profiles{ store.profiles() };
+		for (const ProfileApp &app : store.apps()) {
+			byProgram[std::string(app.program.data(), strnlen(app.program.data(), app.program.size()))] = &profiles[app.profile];
+		}
+		defaultProfile = &profiles.front();
+		current.store(defaultProfile, std::memory_order_release);
+	}
+
+	// File name of the program owning the foreground window. Only asks
+	// Windows for the name when the foreground window or process changed.
+	class ForegroundProgram {
+		HWND lastWindow{ nullptr };
+		DWORD lastProcess{ 0 };
+		std::string name;
+	public:
+		// Returns true if the foreground program may have changed
+		bool update() {
+			HWND window{ GetForegroundWindow() };
+			DWORD process{ 0 };
+			if (window != nullptr) {
+				GetWindowThreadProcessId(window, &process);
+			}
+			if (window == lastWindow && process == lastProcess) {
+				return false;
+			}
+			lastWindow = window;
+			lastProcess = process;
+			name.clear();
+
+			HANDLE handle{ OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, process) };
+			if (handle == nullptr) {
+				return true;
+			}
+			char path[MAX_PATH];
+			DWORD size{ MAX_PATH };
+			if (QueryFullProcessImageNameA(handle, 0, path, &size)) {
+				const std::string full{ path, size };
+				const size_t slash{ full.find_last_of("\\/") };
+				name = slash == std::string::npos ? full : full.substr(slash + 1);
+			}
+			CloseHandle(handle);
+			return true;
+		}
+		const std::string& program() const {
+			return name;
+		}
+	};
+
+	void watch(std::chrono::milliseconds interval) {
+		ForegroundProgram foreground;
+		while (watching.load(std::memory_order_relaxed)) {
+			if (foreground.update() && Profiles::switchTo(foreground.program())) {
+				std::cout << "Switched to profile " << Profiles::active().name.data() << '\n';
+			}
+			std::this_thread::sleep_for(interval);
+		}
+	}
+};
+
+namespace Procon {
+
+	void Profiles::load() {
+		std::call_once(loaded, loadProfiles);
+	}
+
+	const Profile& Profiles::active() {
+		const Profile *profile{ current.load(std::memory_order_acquire) };
+		if (profile == nullptr) {
+			load();
+			profile = current.load(std::memory_order_acquire);
+		}
+		return *profile;
+	}
+
+	bool Profiles::switchTo(const std::string &program) {
+		auto it = byProgram.find(lowercase(program));
+		const Profile *next{ it == byProgram.end() ? defaultProfile : it->second };
+		return current.exchange(next, std::memory_order_acq_rel) != next;
+	}
+
+	void Profiles::startWatcher() {
+		if (byProgram.empty() || watching.exchange(true)) {
+			return; // Nothing to switch between, or already running
+		}
+		const int interval{ std::max(10, Config::get<int32_t>(checkIntervalName).value_or(defaultCheckInterval)) };
+		watcher = std::thread(watch, std::chrono::milliseconds(interval));
+	}
+
+	void Profiles::stopWatcher() {
+		watching.store(false);
+		if (watcher.joinable()) {
+			watcher.join();
+		}
+	}
+
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+
+#include "Pipeline.hpp"
+
+namespace Procon {
+
+	// Per-application mapping profiles.
+	// sProfiles in config.txt lists profile files. Each is read into its own
+	// Config scope, lists the programs it applies to in sProfileApps, and
+	// overrides any mapping setting from config.txt. Every profile is compiled
+	// up front, so switching is a single atomic pointer swap that the polling
+	// loop picks up on its next report. Compiled profiles are kept in
+	// sProfileStore and used from there until config.txt or a profile file
+	// changes, so the profile files aren't read at all on most starts.
+	class Profiles {
+	public:
+		Profiles() = delete;
+		Profiles(const Profiles&) = delete;
+		Profiles& operator=(const Profiles&) = delete;
+
+		// Reads the profile files and compiles every profile, throws ConfigError
+		static void load();
+
+		// The profile for the foreground program, safe from any thread
+		static const Profile& active();
+
+		// Switches to the profile for the program, or the default one.
+		// Returns true if the active profile changed.
+		static bool switchTo(const std::string &program);
+
+		// Background thread following the foreground program every iProfileCheckIntervalMs
+		static void startWatcher();
+		static void stopWatcher();
+	};
+
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "Common.hpp"
+
+namespace Procon {
+
+	// Fields every input report layout has to provide
+	enum class ReportField : uchar {
+		Battery,
+		RightButtons,
+		MiddleButtons,
+		LeftButtons,
+		LeftStickX,
+		LeftStickY,
+		RightStickX,
+		RightStickY,
+		Count
+	};
+
+	enum class FieldTransform : uchar {
+		Unsigned,
+		Signed // Two's complement, sign extended from the field's top bit
+	};
+
+	// Where one field lives: bits [shift, shift + bits) of the little endian
+	// 16 bit word at offset
+	struct FieldLayout {
+		ReportField field;
+		uint16_t offset;
+		uchar shift;
+		uchar bits;
+		FieldTransform transform;
+	};
+
+	// Where the IMU samples live, if the report has them
+	struct MotionLayout {
+		uint16_t offset; // 0 if the report has no IMU data
+		uint16_t stride; // Bytes per sample, accel xyz then gyro xyz as signed 16 bit
+		uchar samples;
+	};
+
+	struct ReportLayout {
+		const char *name;
+		uchar reportId;
+		uint16_t idOffset;
+		uint16_t length; // Bytes needed to read every field
+		std::array<FieldLayout, static_cast<size_t>(ReportField::Count)> fields;
+		MotionLayout motion;
+		std::array<std::array<Button, 8>, 3> buttons; // Bit to button, indexed by ButtonSource
+		std::array<uchar, 3> reservedBits; // Button bits that must be clear, indexed by ButtonSource
+	};
+
+	// Procon button bits are the same in every report that carries them
+	constexpr std::array<std::array<Button, 8>, 3> proconButtons{ {
+		// ButtonSource::Left
+		{ Button::DPadDown, Button::DPadUp, Button::DPadRight, Button::DPadLeft, Button::None, Button::None, Button::L, Button::LZ },
+		// ButtonSource::Right
+		{ Button::Y, Button::X, Button::B, Button::A, Button::None, Button::None, Button::R, Button::RZ },
+		// ButtonSource::Middle, 0x80 is the charging grip
+		{ Button::Minus, Button::Plus, Button::RStick, Button::LStick, Button::Home, Button::Share, Button::None, Button::None }
+	} };
+	// SR/SL on both sides, and the unused middle bit
+	constexpr std::array<uchar, 3> proconReservedBits{ 0x30, 0x30, 0x40 };
+
+	// The input fields of the standard report, at offset from its report id byte
+	constexpr std::array<FieldLayout, static_cast<size_t>(ReportField::Count)> standardFields(uint16_t id) {
+		return { {
+			{ ReportField::Battery, static_cast<uint16_t>(id + 2), 4, 4, FieldTransform::Unsigned },
+			{ ReportField::RightButtons, static_cast<uint16_t>(id + 3), 0, 8, FieldTransform::Unsigned },
+			{ ReportField::MiddleButtons, static_cast<uint16_t>(id + 4), 0, 8, FieldTransform::Unsigned },
+			{ ReportField::LeftButtons, static_cast<uint16_t>(id + 5), 0, 8, FieldTransform::Unsigned },
+			// Sticks are two 12 bit axes in 3 bytes, only the top 8 bits of each are used
+			{ ReportField::LeftStickX, static_cast<uint16_t>(id + 6), 4, 8, FieldTransform::Unsigned },
+			{ ReportField::LeftStickY, static_cast<uint16_t>(id + 8), 0, 8, FieldTransform::Unsigned },
+			{ ReportField::RightStickX, static_cast<uint16_t>(id + 9), 4, 8, FieldTransform::Unsigned },
+			{ ReportField::RightStickY, static_cast<uint16_t>(id + 11), 0, 8, FieldTransform::Unsigned }
+		} };
+	}
+
+	// Full input report wrapped in the USB reply to getInput, what pollInput() reads
+	inline constexpr ReportLayout usbInputLayout{
+		"USB 0x30", 0x30, 10, 59, standardFields(10), { 23, 12, 3 }, proconButtons, proconReservedBits
+	};
+	// Full input report as sent over Bluetooth, without the USB wrapper
+	inline constexpr ReportLayout rawInputLayout{
+		"0x30", 0x30, 0, 49, standardFields(0), { 13, 12, 3 }, proconButtons, proconReservedBits
+	};
+	// Subcommand reply, input fields without IMU data
+	inline constexpr ReportLayout subcommandReplyLayout{
+		"0x21", 0x21, 0, 15, standardFields(0), { 0, 0, 0 }, proconButtons, proconReservedBits
+	};
+
+	// Finds a field's layout, a layout without it doesn't compile
+	constexpr FieldLayout findField(const ReportLayout &layout, ReportField field) {
+		for (const FieldLayout &f : layout.fields) {
+			if (f.field == field) {
+				return f;
+			}
+		}
+		throw "Report layout is missing a field";
+	}
+
+	// Every field exactly once, inside the report, at most 16 bits wide
+	constexpr bool coversAllFields(const ReportLayout &layout) {
+		for (size_t i{ 0 }; i < static_cast<size_t>(ReportField::Count); ++i) {
+			size_t found{ 0 };
+			for (const FieldLayout &f : layout.fields) {
+				if (f.field == static_cast<ReportField>(i)) {
+					++found;
+					const size_t bytes{ f.shift + f.bits > 8u ? 2u : 1u };
+					if (f.bits == 0 || f.shift + f.bits > 16 || f.offset + bytes > layout.length) {
+						return false;
+					}
+				}
+			}
+			if (found != 1) {
+				return false;
+			}
+		}
+		const MotionLayout &m = layout.motion;
+		return layout.idOffset < layout.length
+			&& (m.offset == 0 || m.offset + m.stride * m.samples <= layout.length);
+	}
+	static_assert(coversAllFields(usbInputLayout), "USB input layout is incomplete");
+	static_assert(coversAllFields(rawInputLayout), "0x30 input layout is incomplete");
+	static_assert(coversAllFields(subcommandReplyLayout), "0x21 reply layout is incomplete");
+
+	// Branch-free extractor specialized for one field of one layout, the
+	// offset, shift and mask are all constants
+	template<const ReportLayout &Layout, ReportField Field>
+	inline auto extract(const uchar *report) {
+		constexpr FieldLayout f{ findField(Layout, Field) };
+		constexpr unsigned mask{ (1u << f.bits) - 1 };
+		unsigned raw{ report[f.offset] };
+		if constexpr (f.shift + f.bits > 8) {
+			raw |= static_cast<unsigned>(report[f.offset + 1]) << 8;
+		}
+		const unsigned value{ (raw >> f.shift) & mask };
+		if constexpr (f.transform == FieldTransform::Signed) {
+			constexpr unsigned sign{ 1u << (f.bits - 1) };
+			return static_cast<int16_t>(static_cast<int>(value ^ sign) - static_cast<int>(sign));
+		}
+		else if constexpr (f.bits <= 8) {
+			return static_cast<uchar>(value);
+		}
+		else {
+			return static_cast<uint16_t>(value);
+		}
+	}
+
+	// One IMU channel (accel xyz, gyro xyz) of one sample
+	template<const ReportLayout &Layout>
+	inline int16_t extractMotion(const uchar *report, size_t sample, size_t channel) {
+		static_assert(Layout.motion.offset != 0, "Report layout has no IMU data");
+		const uchar *raw = report + Layout.motion.offset + sample * Layout.motion.stride + channel * 2;
+		return static_cast<int16_t>(raw[0] | (raw[1] << 8));
+	}
+
+};
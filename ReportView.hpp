@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "Common.hpp"
+#include "Controller.hpp"
+#include "ReportLayout.hpp"
+
+namespace Procon {
+
+	// Zero-copy view of a validated input report in usbInputLayout.
+	// Packed fields are only unpacked when asked for, and each is unpacked at
+	// most once per report, so a stage or sink that reads only buttons never
+	// pays for the sticks or the IMU samples.
+	class ReportView {
+		static constexpr const ReportLayout &layout{ usbInputLayout };
+	public:
+		explicit ReportView(const uchar *report) :report(report) {}
+		ReportView(const ReportView&) = delete;
+		ReportView& operator=(const ReportView&) = delete;
+
+		uchar rightButtons() const {
+			return extract<layout, ReportField::RightButtons>(report);
+		}
+		uchar middleButtons() const {
+			return extract<layout, ReportField::MiddleButtons>(report);
+		}
+		uchar leftButtons() const {
+			return extract<layout, ReportField::LeftButtons>(report);
+		}
+		uchar battery() const {
+			return extract<layout, ReportField::Battery>(report);
+		}
+
+		const StickPoint& leftStick() {
+			if ((decoded & LeftStick) == 0) {
+				left = { extract<layout, ReportField::LeftStickX>(report), extract<layout, ReportField::LeftStickY>(report) };
+				decoded |= LeftStick;
+			}
+			return left;
+		}
+		const StickPoint& rightStick() {
+			if ((decoded & RightStick) == 0) {
+				right = { extract<layout, ReportField::RightStickX>(report), extract<layout, ReportField::RightStickY>(report) };
+				decoded |= RightStick;
+			}
+			return right;
+		}
+
+		const MotionSample& motion(size_t sample) {
+			const uchar bit{ static_cast<uchar>(Motion << sample) };
+			if ((decoded & bit) == 0) {
+				for (size_t axis{ 0 }; axis < 3; ++axis) {
+					samples[sample].accel[axis] = extractMotion<layout>(report, sample, axis);
+					samples[sample].gyro[axis] = extractMotion<layout>(report, sample, 3 + axis);
+				}
+				decoded |= bit;
+			}
+			return samples[sample];
+		}
+		// All three samples, oldest first
+		const std::array<MotionSample, 3>& motion() {
+			for (size_t i{ 0 }; i < samples.size(); ++i) {
+				motion(i);
+			}
+			return samples;
+		}
+
+		// Fills the raw fields of an ExpandedPadState, for sinks that want all of them
+		void expand(ExpandedPadState &state) {
+			state.battery = battery();
+			state.leftStick = leftStick();
+			state.rightStick = rightStick();
+			const std::array<MotionSample, 3> &m = motion();
+			std::copy(m.begin(), m.end(), state.motion);
+		}
+
+	private:
+		enum Field : uchar {
+			LeftStick = 0x1,
+			RightStick = 0x2,
+			Motion = 0x4 // One bit per sample from here
+		};
+
+		const uchar *report;
+		uchar decoded{ 0 };
+		StickPoint left;
+		StickPoint right;
+		std::array<MotionSample, 3> samples;
+	};
+
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace Procon {
+
+	// Single writer, multiple reader sequence lock around a trivially copyable T.
+	// The writer never blocks, readers retry only if they raced a store.
+	// The payload is kept as relaxed atomic words so a racing read is torn at
+	// worst, never undefined, and the sequence check throws torn reads away.
+	template<class T>
+	class SeqLock {
+		static_assert(std::is_trivially_copyable_v<T>, "SeqLock requires a trivially copyable type");
+
+		using Word = std::uint32_t;
+		static constexpr size_t wordCount{ (sizeof(T) + sizeof(Word) - 1) / sizeof(Word) };
+		using Words = std::array<Word, wordCount>;
+
+		std::atomic<Word> sequence{ 0 };
+		std::array<std::atomic<Word>, wordCount> words{};
+
+	public:
+		SeqLock() = default;
+		explicit SeqLock(const T& value) {
+			store(value);
+		}
+		// Copying/moving is only valid while no other thread touches either object
+		SeqLock(const SeqLock& other) {
+			store(other.load());
+		}
+		SeqLock& operator=(const SeqLock& other) {
+			store(other.load());
+			return *this;
+		}
+
+		// Writer side, must only ever be called from one thread at a time
+		void store(const T& value) {
+			Words buf{};
+			std::memcpy(buf.data(), &value, sizeof(T));
+
+			const Word seq{ sequence.load(std::memory_order_relaxed) };
+			sequence.store(seq + 1, std::memory_order_relaxed); // Odd = write in progress
+			std::atomic_thread_fence(std::memory_order_release);
+			for (size_t i{ 0 }; i < wordCount; ++i) {
+				words[i].store(buf[i], std::memory_order_relaxed);
+			}
+			sequence.store(seq + 2, std::memory_order_release);
+		}
+
+		// Reader side, safe from any thread
+		T load() const {
+			Words buf;
+			Word before;
+			Word after;
+			do {
+				before = sequence.load(std::memory_order_acquire);
+				for (size_t i{ 0 }; i < wordCount; ++i) {
+					buf[i] = words[i].load(std::memory_order_relaxed);
+				}
+				std::atomic_thread_fence(std::memory_order_acquire);
+				after = sequence.load(std::memory_order_relaxed);
+			} while ((before & 1) != 0 || before != after);
+
+			T out;
+			std::memcpy(&out, buf.data(), sizeof(T));
+			return out;
+		}
+
+		// Number of completed stores, lets readers cheaply tell if anything changed
+		Word version() const {
+			return sequence.load(std::memory_order_acquire) / 2;
+		}
+	};
+
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <array>
+
+#include "Commands.hpp"
+#include "Common.hpp"
+
+namespace Procon {
+
+	// A USB input reply with the sticks centered, for the benchmarks. They
+	// bump the timer byte (11) and toggle A (13) themselves.
+	inline std::array<uchar, exchangeLen> simulatedReply() {
+		std::array<uchar, exchangeLen> reply{};
+		reply[0] = 0x81;
+		reply[1] = 0x92;
+		reply[3] = 0x31;
+		reply[10] = 0x30;
+		reply[12] = 0x90;
+		for (size_t stick : { 16, 19 }) {
+			reply[stick + 1] = 0x08;
+			reply[stick + 2] = 0x80;
+		}
+		return reply;
+	}
+
+};
@@ -0,0 +1,186 @@
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "Clock.hpp"
+#include "Config.hpp"
+#include "Controller.hpp"
+
+namespace {
+	using namespace Procon;
+	using namespace std::chrono;
+
+	constexpr size_t controllerCount{ 2 };
+	constexpr auto reportInterval = milliseconds(8);
+	// One cycle of the script: play, then rest, then unplugged
+	constexpr auto playTime = minutes(4);
+	constexpr auto restTime = minutes(5) + seconds(55);
+	constexpr auto unpluggedTime = seconds(5);
+	constexpr auto cycleTime = playTime + restTime + unpluggedTime;
+
+	constexpr uchar getInputCommand{ 0x1f };
+	constexpr uchar rumbleCommand{ 0x10 };
+	constexpr uchar subcommandCommand{ 0x01 };
+
+	struct DeviceStats {
+		size_t reports{ 0 }; // Input reports answered
+		size_t rumbles{ 0 }; // Rumble packets received
+		size_t subcommands{ 0 }; // LED and other subcommands received
+	};
+
+	// Answers commands like a Procon following the script. Input reports
+	// come every 8ms, a read waits for the next one by moving the clock.
+	class ScriptedProcon : public SimulatedDevice {
+	public:
+		ScriptedProcon(VirtualClock &clock, Clock::duration offset) :clock(clock), offset(offset) {
+			reply[0] = 0x81;
+			reply[1] = 0x92;
+			reply[3] = 0x31;
+			reply[12] = 0x90; // Full battery
+		}
+
+		void write(const uchar *data, size_t length) override {
+			lastCommand = length > 8 ? data[8] : 0;
+			lastSubcommand = length > 18 ? data[18] : 0;
+			if (lastCommand == rumbleCommand) {
+				++totals.rumbles;
+			}
+			else if (lastCommand == subcommandCommand) {
+				++totals.subcommands;
+			}
+		}
+
+		int read(uchar *buffer, size_t length, int timeoutMs) override {
+			const Clock::duration phase{ (clock.now().time_since_epoch() + offset) % cycleTime };
+			if (phase >= playTime + restTime) {
+				clock.sleepFor(milliseconds(timeoutMs)); // Unplugged, the read times out
+				return 0;
+			}
+			if (lastCommand != getInputCommand) {
+				// Subcommand reply, answered right away with the id it answers
+				std::array<uchar, subcommandReplyData + 1> ack{};
+				std::copy(reply.begin(), reply.begin() + 10, ack.begin());
+				ack[10] = 0x21;
+				ack[24] = lastSubcommand;
+				std::copy(ack.begin(), ack.begin() + std::min(length, ack.size()), buffer);
+				return static_cast<int>(std::min(length, ack.size()));
+			}
+			// Wait for the next report the controller sends, one sent since the
+			// last read is already waiting
+			clock.advanceTo(nextReport);
+			nextReport = Clock::time_point{ (clock.now().time_since_epoch() / reportInterval + 1) * reportInterval };
+			fillInput(phase < playTime);
+			std::copy(reply.begin(), reply.begin() + std::min(length, reply.size()), buffer);
+			++totals.reports;
+			return static_cast<int>(reply.size());
+		}
+
+		const DeviceStats& stats() const {
+			return totals;
+		}
+
+	private:
+		void fillInput(bool playing) {
+			++sequence;
+			reply[10] = 0x30;
+			reply[11] = static_cast<uchar>(sequence);
+			const double t{ duration<double>(clock.now().time_since_epoch()).count() };
+			// Playing: sticks circle and A is tapped, resting: centered with a little sensor noise
+			const int noise{ static_cast<int>(sequence % 2) };
+			const int lx{ playing ? 128 + static_cast<int>(100 * std::cos(t)) : 128 + noise };
+			const int ly{ playing ? 128 + static_cast<int>(100 * std::sin(t)) : 128 };
+			const int rx{ playing ? 128 + static_cast<int>(100 * std::sin(t * 0.7)) : 128 };
+			const int ry{ playing ? 128 + static_cast<int>(100 * std::cos(t * 0.7)) : 128 + noise };
+			reply[13] = playing && (sequence / 25) % 2 == 0 ? 0x08 : 0x00;
+			packStick(reply.data() + 16, lx, ly);
+			packStick(reply.data() + 19, rx, ry);
+			const short gyro{ static_cast<short>(playing ? 2000 * std::sin(t * 3) : static_cast<int>(sequence % 5) * 10) };
+			for (size_t sample{ 0 }; sample < 3; ++sample) {
+				uchar *imu = reply.data() + 23 + sample * 12;
+				imu[4] = 0x00; // Accel Z at 1g
+				imu[5] = 0x10;
+				imu[10] = static_cast<uchar>(gyro & 0xFF); // Gyro Z
+				imu[11] = static_cast<uchar>((gyro >> 8) & 0xFF);
+			}
+		}
+
+		// 8 bit positions into the 12 bit axes of the report
+		static void packStick(uchar *raw, int x, int y) {
+			raw[0] = static_cast<uchar>((x & 0x0F) << 4);
+			raw[1] = static_cast<uchar>(((x >> 4) & 0x0F) | ((y & 0x0F) << 4));
+			raw[2] = static_cast<uchar>(y);
+		}
+
+		VirtualClock &clock;
+		Clock::duration offset; // Where in the script this controller starts
+		std::array<uchar, 64> reply{};
+		Clock::time_point nextReport{};
+		uchar lastCommand{ 0 };
+		uchar lastSubcommand{ 0 };
+		size_t sequence{ 0 };
+		DeviceStats totals{};
+	};
+};
+
+namespace Procon {
+
+	int runSimulation(std::ostream &out, double hours) {
+		try {
+			VirtualClock clock;
+			std::vector<ScriptedProcon> devices;
+			std::vector<Controller> controllers;
+			devices.reserve(controllerCount);
+			controllers.reserve(controllerCount);
+			for (size_t i{ 0 }; i < controllerCount; ++i) {
+				devices.emplace_back(clock, duration_cast<Clock::duration>(cycleTime) * i / controllerCount);
+				controllers.emplace_back(static_cast<uchar>(i), clock);
+				controllers.back().attachSimulatedDevice(devices.back());
+			}
+
+			out << "Simulating " << hours << " hours of " << controllerCount << " controllers...\n";
+			const Clock::time_point end{ clock.now() + duration_cast<Clock::duration>(duration<double, std::ratio<3600>>(hours)) };
+			const steady_clock::time_point started{ steady_clock::now() };
+			size_t passes{ 0 };
+			while (clock.now() < end) {
+				pollControllers(controllers, clock);
+				++passes;
+			}
+			const double wall{ duration<double>(steady_clock::now() - started).count() };
+			out << "Done in " << wall << "s, " << passes << " loop passes\n";
+
+			for (size_t i{ 0 }; i < controllerCount; ++i) {
+				const IdleStats idle = controllers[i].getIdleStats();
+				const WatchdogStats watchdog = controllers[i].getWatchdogStats();
+				const OutputStats output = controllers[i].getOutputStats();
+				const DeviceStats &device = devices[i].stats();
+				out << "Controller " << i + 1 << ": "
+					<< device.reports << " reports, "
+					<< device.rumbles << " rumble packets, "
+					<< device.subcommands << " subcommands, "
+					<< output.deferred << " deferred, "
+					<< output.dropped << " rumble dropped, "
+					<< duration_cast<seconds>(idle.activeTime).count() << "s active, "
+					<< duration_cast<seconds>(idle.idleTime).count() << "s idle, "
+					<< idle.idleEntries << " idle entries, "
+					<< idle.skippedPolls << " polls skipped, "
+					<< watchdog.readTimeouts << " read timeouts, "
+					<< watchdog.stalls << " stalls, "
+					<< watchdog.recoveries << " recoveries\n";
+			}
+		}
+		catch (ControllerException &e) {
+			out << "ControllerException: " << e.what() << '\n';
+			return -1;
+		}
+		catch (const ConfigError &e) {
+			out << "Error in config file: " << e.what() << '\n';
+			return -1;
+		}
+		return 0;
+	}
+
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <ostream>
+
+namespace Procon {
+
+	// Virtual time simulation, run with --simulate [hours].
+	// Scripted controllers cycle through play, rest and being unplugged
+	// while the real main loop, Controller, idle detector, watchdog and
+	// haptics run against a VirtualClock. Reads jump straight to the time the
+	// next report would arrive, so hours of activity take seconds at most.
+	// Prints the timing statistics for regression checks. Needs no hardware
+	// or ScpVBus.
+	int runSimulation(std::ostream &out, double hours);
+
+};
@@ -0,0 +1,121 @@
+#include "Slots.hpp"
+
+#include <array>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "Config.hpp"
+
+namespace {
+	using namespace Procon;
+
+	const std::string slotFileName{ "sSlotFile" };
+	const std::string defaultSlotFile{ "slots.txt" };
+
+	std::mutex slotMutex;
+	bool loaded{ false };
+	std::unordered_map<std::string, uchar> remembered; // Controller to slot
+	std::array<bool, maxSlots> taken{};
+
+	std::string slotFile() {
+		return Config::get<std::string>(slotFileName).value_or(defaultSlotFile);
+	}
+
+	// The MAC is the same on every USB port, fall back to the HID key if it couldn't be read
+	std::string slotKey(const ControllerIdentity &identity) {
+		for (uchar b : identity.mac) {
+			if (b != 0) {
+				return identity.macString();
+			}
+		}
+		return identity.key;
+	}
+
+	// One controller per line: key, slot, tab separated
+	void load() {
+		loaded = true;
+		const std::string file{ slotFile() };
+		if (file.empty() || file == "None") {
+			return;
+		}
+		std::ifstream in{ file };
+		std::string line;
+		while (std::getline(in, line)) {
+			std::stringstream fields{ line };
+			std::string key;
+			unsigned int slot{ maxSlots };
+			if (std::getline(fields, key, '\t') && (fields >> slot) && slot < maxSlots) {
+				remembered[key] = static_cast<uchar>(slot);
+			}
+		}
+	}
+
+	void save() {
+		const std::string file{ slotFile() };
+		if (file.empty() || file == "None") {
+			return;
+		}
+		std::ofstream out{ file, std::ios::trunc };
+		for (const auto &[key, slot] : remembered) {
+			out << key << '\t' << static_cast<int>(slot) << '\n';
+		}
+	}
+
+	bool reserved(uchar slot) {
+		for (const auto &entry : remembered) {
+			if (entry.second == slot) {
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+namespace Procon {
+
+	std::optional<uchar> SlotTable::claim(const ControllerIdentity &identity) {
+		std::lock_guard<std::mutex> lock{ slotMutex };
+		if (!loaded) {
+			load();
+		}
+		const std::string key{ slotKey(identity) };
+		auto known = remembered.find(key);
+		if (known != remembered.end() && !taken[known->second]) {
+			taken[known->second] = true;
+			return known->second;
+		}
+		std::optional<uchar> slot;
+		for (uchar s{ 0 }; s < maxSlots && !slot; ++s) {
+			if (!taken[s] && !reserved(s)) {
+				slot = s;
+			}
+		}
+		// Every free slot belongs to someone, take one anyway rather than refuse
+		for (uchar s{ 0 }; s < maxSlots && !slot; ++s) {
+			if (!taken[s]) {
+				slot = s;
+			}
+		}
+		if (slot) {
+			taken[*slot] = true;
+			// Whoever else remembered this slot gets another one next time
+			for (auto it = remembered.begin(); it != remembered.end();) {
+				it = it->second == *slot ? remembered.erase(it) : std::next(it);
+			}
+			remembered[key] = *slot;
+			save();
+		}
+		return slot;
+	}
+
+	void SlotTable::release(uchar slot) {
+		std::lock_guard<std::mutex> lock{ slotMutex };
+		if (slot < maxSlots) {
+			taken[slot] = false;
+		}
+	}
+
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <optional>
+
+#include "Common.hpp"
+#include "Identity.hpp"
+
+namespace Procon {
+
+	constexpr uchar maxSlots{ 4 }; // ScpVBus pads, XInput's user indexes
+
+	// Which player slot (XOutput port) each controller gets. Slots follow the
+	// controller rather than enumeration order, and are remembered in the
+	// sSlotFile file so players keep their slots across restarts.
+	class SlotTable {
+	public:
+		SlotTable() = delete;
+		SlotTable(const SlotTable&) = delete;
+		SlotTable& operator=(const SlotTable&) = delete;
+
+		// The controller's remembered slot if it's free, otherwise the lowest
+		// free slot no other known controller remembers, otherwise any free
+		// slot. Empty if every slot is taken.
+		static std::optional<uchar> claim(const ControllerIdentity &identity);
+		// Frees the slot for this run, it stays remembered for its controller
+		static void release(uchar slot);
+	};
+
+};
@@ -0,0 +1,184 @@
+#include "Stream.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <aclapi.h>
+#include <sddl.h>
+
+namespace {
+	using namespace Procon;
+
+	// SYSTEM and administrators get full access, any signed in user may read
+	const char streamAccess[]{ "D:(A;;GA;;;SY)(A;;GA;;;BA)(A;;GR;;;AU)" };
+
+	std::string mappingName(unsigned int port) {
+		return "Local\\ProconXInputStream" + std::to_string(port);
+	}
+
+	// True if an existing mapping was created by this process' owner, a
+	// reader that exited while consumers still had the stream open. Anyone
+	// else could have pre-created it with access of their choosing.
+	bool ownedByUs(HANDLE mapping) {
+		PSID owner{ nullptr };
+		PSECURITY_DESCRIPTOR descriptor{ nullptr };
+		if (GetSecurityInfo(mapping, SE_KERNEL_OBJECT, OWNER_SECURITY_INFORMATION, &owner, nullptr, nullptr, nullptr, &descriptor) != ERROR_SUCCESS) {
+			return false;
+		}
+		bool same{ false };
+		HANDLE token{ nullptr };
+		if (OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token)) {
+			DWORD size{ 0 };
+			GetTokenInformation(token, TokenOwner, nullptr, 0, &size);
+			std::vector<BYTE> buffer(size);
+			if (size != 0 && GetTokenInformation(token, TokenOwner, buffer.data(), size, &size)) {
+				same = EqualSid(owner, reinterpret_cast<const TOKEN_OWNER*>(buffer.data())->Owner) != FALSE;
+			}
+			CloseHandle(token);
+		}
+		LocalFree(descriptor);
+		return same;
+	}
+};
+
+namespace Procon {
+
+	StreamWriter::StreamWriter(unsigned int port) {
+		SECURITY_ATTRIBUTES security{ sizeof(SECURITY_ATTRIBUTES), nullptr, FALSE };
+		if (!ConvertStringSecurityDescriptorToSecurityDescriptorA(streamAccess, SDDL_REVISION_1, &security.lpSecurityDescriptor, nullptr)) {
+			throw ControllerException("Unable to set up access to the report stream.");
+		}
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, &security, PAGE_READWRITE, 0, sizeof(StreamRing), mappingName(port).c_str());
+		const DWORD created{ GetLastError() };
+		LocalFree(security.lpSecurityDescriptor);
+		if (mapping == nullptr) {
+			throw ControllerException("Unable to create the report stream.");
+		}
+		// Our access settings only apply to a mapping we created
+		if (created == ERROR_ALREADY_EXISTS && !ownedByUs(mapping)) {
+			CloseHandle(mapping);
+			throw ControllerException("The report stream was already created by another user.");
+		}
+		void *view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(StreamRing));
+		if (view == nullptr) {
+			CloseHandle(mapping);
+			throw ControllerException("Unable to map the report stream.");
+		}
+		ring = new (view) StreamRing{};
+		ring->magic = streamMagic;
+		ring->version = streamVersion;
+		ring->entrySize = sizeof(StreamEntry);
+	}
+
+	StreamWriter::~StreamWriter() {
+		UnmapViewOfFile(ring);
+		CloseHandle(mapping);
+	}
+
+	void StreamWriter::publish(const uchar *report, size_t length, clock::time_point received, const ExpandedPadState &state) {
+		StreamEntry &entry = ring->entries[head % streamCapacity];
+		// Same protocol as SeqLock, a consumer still on this entry sees it change
+		entry.sequence.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		const size_t copied{ std::min(length, streamReportLen) };
+		if (copied != 0) {
+			std::memcpy(entry.report.data(), report, copied);
+		}
+		entry.length = static_cast<uint32_t>(copied);
+		entry.received = received.time_since_epoch().count();
+		entry.state = state;
+		entry.sequence.store(head + 1, std::memory_order_release);
+		ring->head.store(++head, std::memory_order_release);
+	}
+
+	StreamReader::StreamReader(unsigned int port) {
+		mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, mappingName(port).c_str());
+		if (mapping == nullptr) {
+			throw std::runtime_error("Controller has no report stream, is the reader running?");
+		}
+		ring = static_cast<const StreamRing*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(StreamRing)));
+		if (ring == nullptr || ring->magic != streamMagic || ring->version != streamVersion || ring->entrySize != sizeof(StreamEntry)) {
+			release();
+			throw std::runtime_error("Report stream has an unknown layout");
+		}
+		// Only reports published from now on
+		position = ring->head.load(std::memory_order_acquire);
+	}
+
+	StreamReader::StreamReader(StreamReader &&other) noexcept {
+		*this = std::move(other);
+	}
+
+	StreamReader& StreamReader::operator=(StreamReader &&other) noexcept {
+		if (this != &other) {
+			release();
+			mapping = std::exchange(other.mapping, nullptr);
+			ring = std::exchange(other.ring, nullptr);
+			position = other.position;
+			current = std::exchange(other.current, nullptr);
+			skippedReports = other.skippedReports;
+		}
+		return *this;
+	}
+
+	StreamReader::~StreamReader() {
+		release();
+	}
+
+	void StreamReader::release() {
+		if (ring != nullptr) {
+			UnmapViewOfFile(ring);
+			ring = nullptr;
+		}
+		if (mapping != nullptr) {
+			CloseHandle(mapping);
+			mapping = nullptr;
+		}
+	}
+
+	const StreamEntry* StreamReader::next() {
+		current = nullptr;
+		while (true) {
+			const uint32_t head{ ring->head.load(std::memory_order_acquire) };
+			if (head == position) {
+				return nullptr;
+			}
+			if (static_cast<int32_t>(head - position) < 0) {
+				// The reader process restarted and the ring with it
+				position = 0;
+				continue;
+			}
+			if (head - position >= streamCapacity) {
+				// A whole ring behind, only the newest report is still worth reading
+				skippedReports += head - 1 - position;
+				position = head - 1;
+			}
+			const StreamEntry &entry = ring->entries[position % streamCapacity];
+			++position;
+			if (entry.sequence.load(std::memory_order_acquire) == position) {
+				current = &entry;
+				return current;
+			}
+			// Overwritten before we got to it
+			++skippedReports;
+		}
+	}
+
+	bool StreamReader::valid() const {
+		if (current == nullptr) {
+			return false;
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return current->sequence.load(std::memory_order_relaxed) == position;
+	}
+
+	size_t StreamReader::skipped() const {
+		return skippedReports;
+	}
+
+};
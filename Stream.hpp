@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+
+#include "Common.hpp"
+#include "Controller.hpp"
+
+namespace Procon {
+
+	// Shared memory layout of "Local\ProconXInputStream<port>", one per
+	// controller. Single producer (the --reader process), any number of
+	// consumers, which only get read access. Nothing waits on consumers: a
+	// consumer that falls a whole ring behind skips to the newest report.
+	constexpr uint32_t streamMagic{ 0x54535850 }; // "PXST"
+	constexpr uint32_t streamVersion{ 1 };
+	constexpr uint32_t streamCapacity{ 64 }; // Half a second of reports
+	constexpr size_t streamReportLen{ 64 }; // One USB packet, everything usbInputLayout reads
+	struct alignas(cacheLine) StreamEntry {
+		// Report number + 1 once written, 0 while the entry is rewritten
+		std::atomic<uint32_t> sequence;
+		uint32_t length; // Bytes of report, as read from the device. 0 when the reader lost the controller.
+		int64_t received; // steady_clock ticks, the same clock in every process
+		ExpandedPadState state; // Decoded with the reader's profile and calibration
+		std::array<uchar, streamReportLen> report; // The raw USB reply, for consumers doing their own mapping
+	};
+	struct StreamRing {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t entrySize; // sizeof(StreamEntry), a consumer built differently can't misread it
+		alignas(cacheLine) std::atomic<uint32_t> head; // Reports published
+		std::array<StreamEntry, streamCapacity> entries;
+	};
+	static_assert(std::atomic<uint32_t>::is_always_lock_free, "Stream indices must be lock-free to be shared between processes");
+
+	// Reader process side, fed by Controller::processReport()
+	// Throws ControllerException if the ring can't be created.
+	class StreamWriter {
+	public:
+		using clock = std::chrono::steady_clock;
+
+		explicit StreamWriter(unsigned int port);
+		StreamWriter(const StreamWriter&) = delete;
+		StreamWriter& operator=(const StreamWriter&) = delete;
+		~StreamWriter();
+
+		void publish(const uchar *report, size_t length, clock::time_point received, const ExpandedPadState &state);
+
+	private:
+		HANDLE mapping{ nullptr };
+		StreamRing *ring{ nullptr };
+		uint32_t head{ 0 };
+	};
+
+	// Consumer side, maps a controller's ring read-only.
+	// Copy what's needed out of an entry, then check valid() before using the
+	// copy, the reader may have reused the entry meanwhile.
+	class StreamReader {
+	public:
+		explicit StreamReader(unsigned int port); // Throws std::runtime_error if the controller isn't streamed
+		StreamReader(StreamReader &&other) noexcept;
+		StreamReader& operator=(StreamReader &&other) noexcept;
+		StreamReader(const StreamReader&) = delete;
+		StreamReader& operator=(const StreamReader&) = delete;
+		~StreamReader();
+
+		// The next report, null if there's nothing new
+		const StreamEntry* next();
+		// The entry next() returned last wasn't overwritten since
+		bool valid() const;
+		// Reports skipped because the reader got a whole ring ahead
+		size_t skipped() const;
+
+	private:
+		void release();
+
+		HANDLE mapping{ nullptr };
+		const StreamRing *ring{ nullptr };
+		uint32_t position{ 0 };
+		const StreamEntry *current{ nullptr };
+		size_t skippedReports{ 0 };
+	};
+
+};
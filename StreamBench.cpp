@@ -0,0 +1,163 @@
+#include "StreamBench.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Common.hpp"
+#include "Consumer.hpp"
+#include "Controller.hpp"
+#include "SimulatedReply.hpp"
+#include "Slots.hpp"
+#include "Stream.hpp"
+
+namespace {
+	using namespace Procon;
+	using clock = Controller::clock;
+
+	constexpr unsigned int benchPort{ 255 }; // Never a real controller's stream
+	constexpr size_t reportCount{ 4000 };
+	constexpr auto reportInterval = std::chrono::microseconds(500);
+	constexpr auto consumerIdleLimit = std::chrono::seconds(1); // Nothing new for this long, the publisher is done
+	constexpr double budgetUs{ 20.0 };
+
+	// Runs this program again as the bench's consumer, sharing the console
+	bool spawnConsumer(HANDLE ready, PROCESS_INFORMATION &process) {
+		std::array<char, MAX_PATH> exe{};
+		if (GetModuleFileNameA(nullptr, exe.data(), static_cast<DWORD>(exe.size())) == 0) {
+			return false;
+		}
+		std::string command{ '"' + std::string(exe.data()) + "\" " + streamBenchConsumerArg + ' '
+			+ std::to_string(reinterpret_cast<uintptr_t>(ready)) };
+		STARTUPINFOA startup{};
+		startup.cb = sizeof(startup);
+		return CreateProcessA(nullptr, command.data(), nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startup, &process) != FALSE;
+	}
+
+	// A virtual pad in the first free slot from the end, real controllers take them from the start
+	Controller plugInBenchPad() {
+		for (uchar port{ maxSlots }; port-- > 0;) {
+			Controller pad{ port };
+			try {
+				pad.plugIn();
+				return pad;
+			}
+			catch (ControllerException &) {
+				continue;
+			}
+		}
+		throw ControllerException("No free virtual pad slot for the benchmark.");
+	}
+};
+
+namespace Procon {
+
+	int runStreamBench(std::ostream &out) {
+		try {
+			StreamWriter writer{ benchPort };
+			SECURITY_ATTRIBUTES inheritable{ sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+			HANDLE ready = CreateEventA(&inheritable, TRUE, FALSE, nullptr);
+			if (ready == nullptr) {
+				throw ControllerException("Unable to create the benchmark's ready event.");
+			}
+			auto closeReady = make_scoped([ready] { CloseHandle(ready); });
+			PROCESS_INFORMATION consumer{};
+			if (!spawnConsumer(ready, consumer)) {
+				throw ControllerException("Unable to start the benchmark's consumer process.");
+			}
+			auto closeConsumer = make_scoped([&consumer] {
+				CloseHandle(consumer.hThread);
+				CloseHandle(consumer.hProcess);
+			});
+			// The consumer fails before it's ready if it can't plug in its pad
+			const std::array<HANDLE, 2> waitFor{ ready, consumer.hProcess };
+			if (WaitForMultipleObjects(static_cast<DWORD>(waitFor.size()), waitFor.data(), FALSE, INFINITE) == WAIT_OBJECT_0) {
+				// Flushed so the consumer's results, printed to the same console, come after it
+				out << "Measuring report stream latency to a consumer process, " << reportCount << " reports..." << std::endl;
+				std::array<uchar, exchangeLen> reply{ simulatedReply() };
+				ExpandedPadState state{};
+				clock::time_point due{ clock::now() };
+				for (size_t i{ 0 }; i < reportCount; ++i) {
+					while (clock::now() < due) {
+						std::this_thread::yield();
+					}
+					++reply[11];
+					reply[13] = (i & 0x8) != 0 ? 0x08 : 0x00;
+					writer.publish(reply.data(), streamReportLen, clock::now(), state);
+					due += reportInterval;
+				}
+			}
+			WaitForSingleObject(consumer.hProcess, INFINITE);
+			DWORD result{ 0 };
+			if (!GetExitCodeProcess(consumer.hProcess, &result)) {
+				return -1;
+			}
+			return static_cast<int>(result);
+		}
+		catch (ControllerException &e) {
+			out << "ControllerException: " << e.what() << '\n';
+			return -1;
+		}
+	}
+
+	int runStreamBenchConsumer(std::ostream &out, const char *readyHandle) {
+		try {
+			StreamReader reader{ benchPort };
+			Controller pad{ plugInBenchPad() };
+			HANDLE ready = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(std::strtoull(readyHandle, nullptr, 10)));
+			SetEvent(ready);
+			CloseHandle(ready);
+
+			std::vector<double> latencies;
+			latencies.reserve(reportCount);
+			size_t torn{ 0 };
+			clock::time_point lastEntry{ clock::now() };
+			while (latencies.size() + torn + reader.skipped() < reportCount && clock::now() - lastEntry < consumerIdleLimit) {
+				const StreamEntry *entry = reader.next();
+				if (entry == nullptr) {
+					std::this_thread::yield();
+					continue;
+				}
+				clock::time_point published;
+				if (!consumeEntry(reader, *entry, pad, published)) {
+					++torn;
+					continue;
+				}
+				lastEntry = clock::now();
+				latencies.push_back(std::chrono::duration<double, std::micro>(lastEntry - published).count());
+			}
+
+			if (latencies.empty()) {
+				out << "No reports came through.\n";
+				return -1;
+			}
+			std::sort(latencies.begin(), latencies.end());
+			const auto percentile = [&latencies](double p) {
+				return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+			};
+			const double p99{ percentile(0.99) };
+			out << latencies.size() << " reports, min " << latencies.front()
+				<< "us, median " << percentile(0.5)
+				<< "us, p99 " << p99
+				<< "us, max " << latencies.back() << "us\n";
+			out << reader.skipped() << " skipped, " << torn << " overwritten while copying\n";
+			out << (p99 <= budgetUs ? "Within" : "Over") << " the " << budgetUs << "us budget\n";
+			return p99 <= budgetUs ? 0 : -1;
+		}
+		catch (ControllerException &e) {
+			out << "ControllerException: " << e.what() << '\n';
+			return -1;
+		}
+		catch (const std::runtime_error &e) {
+			out << "Error: " << e.what() << '\n';
+			return -1;
+		}
+	}
+
+};
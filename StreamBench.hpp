@@ -0,0 +1,23 @@
+#pragma once
+
+#include <ostream>
+
+namespace Procon {
+
+	// Argument that starts this program as the stream benchmark's consumer,
+	// followed by the handle of the event to set once it's ready
+	constexpr char streamBenchConsumerArg[]{ "--stream-bench-consumer" };
+
+	// Report stream latency benchmark, run with --stream-bench.
+	// Publishes simulated reports into a report stream and starts this
+	// program again as a consumer process, which maps the stream read-only
+	// and feeds every report to a virtual pad the way --consumer does. The
+	// consumer prints the distribution of the time from a report being
+	// published to XOutput having taken it. Needs ScpVBus, but no hardware.
+	// Returns non-zero if the 99th percentile is over the 20us budget.
+	int runStreamBench(std::ostream &out);
+	// The consumer process' side, readyHandle is the event handle as passed on
+	// the command line
+	int runStreamBenchConsumer(std::ostream &out, const char *readyHandle);
+
+};
@@ -0,0 +1,101 @@
+#include "Usage.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+
+#include "ReportView.hpp"
+
+namespace {
+	using namespace Procon;
+
+	constexpr BYTE triggerPressed{ 0x80 };
+
+	// Same order as the bits of the mask update() builds
+	constexpr std::array<const char*, usageButtons> buttonNames{
+		"DPadUp", "DPadDown", "DPadLeft", "DPadRight", "Start", "Back", "LThumb", "RThumb",
+		"LB", "RB", "Guide", nullptr, "A", "B", "X", "Y", "LT", "RT"
+	};
+
+	size_t stickBucket(SHORT x, SHORT y) {
+		const int deflection{ std::max(std::abs(static_cast<int>(x)), std::abs(static_cast<int>(y))) };
+		return std::min(stickBuckets - 1, static_cast<size_t>(deflection >> 11));
+	}
+
+	template<class Counts>
+	void writeCounts(std::ostream &out, const char *name, const Counts &counts) {
+		out << name;
+		for (uint64_t count : counts) {
+			out << ' ' << count;
+		}
+		out << '\n';
+	}
+};
+
+namespace Procon {
+
+	UsageTracker::UsageTracker(clock::time_point start) :start(start) {}
+
+	void UsageTracker::update(const XINPUT_GAMEPAD &pad, ReportView &report, clock::time_point now) {
+		++reports;
+		const uint32_t buttons{ pad.wButtons
+			| (pad.bLeftTrigger >= triggerPressed ? 1u << 16 : 0u)
+			| (pad.bRightTrigger >= triggerPressed ? 1u << 17 : 0u) };
+		// Only presses and releases are visited, holding adds nothing per report
+		for (uint32_t changed{ buttons ^ held }; changed != 0; changed &= changed - 1) {
+			const size_t bit{ static_cast<size_t>(std::countr_zero(changed)) };
+			if ((buttons & (1u << bit)) != 0) {
+				++presses[bit];
+				pressedAt[bit] = now;
+			}
+			else {
+				holdTime[bit] += now - pressedAt[bit];
+			}
+		}
+		held = buttons;
+
+		const std::array<std::array<int, 2>, 2> sticks{ {
+			{ pad.sThumbLX, pad.sThumbLY },
+			{ pad.sThumbRX, pad.sThumbRY }
+		} };
+		for (size_t i{ 0 }; i < sticks.size(); ++i) {
+			++stickHistogram[i][stickBucket(static_cast<SHORT>(sticks[i][0]), static_cast<SHORT>(sticks[i][1]))];
+			stickTravel[i] += std::abs(sticks[i][0] - lastStick[i][0]) + std::abs(sticks[i][1] - lastStick[i][1]);
+		}
+		lastStick = sticks;
+
+		// Unpacking the IMU costs more than everything above, a sample now and then is enough
+		if (motionCountdown-- == 0) {
+			motionCountdown = motionSampleEvery - 1;
+			const MotionSample &sample = report.motion(0);
+			int fastest{ 0 };
+			for (int16_t rate : sample.gyro) {
+				fastest = std::max(fastest, std::abs(static_cast<int>(rate)));
+			}
+			++motionHistogram[std::bit_width(static_cast<unsigned int>(fastest))];
+		}
+	}
+
+	void UsageTracker::write(std::ostream &out, clock::time_point now) const {
+		using std::chrono::duration;
+		out << "seconds " << duration<double>(now - start).count() << '\n';
+		out << "reports " << reports << '\n';
+		for (size_t i{ 0 }; i < usageButtons; ++i) {
+			if (buttonNames[i] == nullptr) {
+				continue;
+			}
+			clock::duration total{ holdTime[i] };
+			if ((held & (1u << i)) != 0) {
+				total += now - pressedAt[i];
+			}
+			out << "button " << buttonNames[i] << ' ' << presses[i] << " presses "
+				<< duration<double>(total).count() << "s held\n";
+		}
+		writeCounts(out, "leftStickHistogram", stickHistogram[0]);
+		writeCounts(out, "rightStickHistogram", stickHistogram[1]);
+		out << "leftStickTravel " << stickTravel[0] << '\n';
+		out << "rightStickTravel " << stickTravel[1] << '\n';
+		writeCounts(out, "gyroHistogram", motionHistogram);
+	}
+
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <Xinput.h>
+
+#include "Common.hpp"
+
+namespace Procon {
+
+	class ReportView;
+
+	constexpr size_t usageButtons{ 18 }; // XInput's 16 button bits, then LT and RT
+	constexpr size_t stickBuckets{ 16 }; // Deflection, 1/16 of full travel each
+	constexpr size_t motionBuckets{ 17 }; // Gyro rate, by bit width of the fastest axis
+	constexpr unsigned int motionSampleEvery{ 8 }; // Reports between IMU samples
+
+	// Per-controller usage statistics for bUsageStats.
+	// Fed the mapped pad after every report. Button counters only change on
+	// presses and releases, the sticks add one histogram count each and the
+	// IMU is only read every motionSampleEvery reports, all into fixed-size
+	// arrays. Written out by write(), never by update().
+	class UsageTracker {
+	public:
+		using clock = std::chrono::steady_clock;
+
+		explicit UsageTracker(clock::time_point start);
+
+		void update(const XINPUT_GAMEPAD &pad, ReportView &report, clock::time_point now);
+		// Buttons still held count up to now
+		void write(std::ostream &out, clock::time_point now) const;
+
+	private:
+		clock::time_point start;
+		uint64_t reports{ 0 };
+		uint32_t held{ 0 }; // Bit per usageButtons entry
+		std::array<clock::time_point, usageButtons> pressedAt{};
+		std::array<uint64_t, usageButtons> presses{};
+		std::array<clock::duration, usageButtons> holdTime{};
+
+		// Left then right
+		std::array<std::array<uint64_t, stickBuckets>, 2> stickHistogram{};
+		std::array<uint64_t, 2> stickTravel{}; // Sum of movement between reports, XInput units
+		std::array<std::array<int, 2>, 2> lastStick{};
+
+		unsigned int motionCountdown{ 0 };
+		std::array<uint64_t, motionBuckets> motionHistogram{};
+	};
+
+};
@@ -0,0 +1,81 @@
+#include "Watchdog.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include "Config.hpp"
+
+namespace {
+	const std::string readTimeoutName{ "iReadTimeoutMs" };
+	const std::string expectedReportName{ "iExpectedReportMs" };
+	const std::string stallPeriodsName{ "iStallPeriods" };
+	const std::string probeIntervalName{ "iStallProbeIntervalMs" };
+
+	constexpr int defaultReadTimeout{ 50 };
+	constexpr int defaultExpectedReport{ 8 };
+	constexpr int defaultStallPeriods{ 16 };
+	constexpr int defaultProbeInterval{ 1000 };
+};
+
+namespace Procon {
+
+	StallWatchdog::StallWatchdog(clock::time_point start) :lastReport(start), lastProbe(start) {
+		using std::chrono::milliseconds;
+
+		// hidapi treats a negative timeout as blocking forever, never allow that
+		timeoutMs = std::max(1, Config::get<int32_t>(readTimeoutName).value_or(defaultReadTimeout));
+		const int period{ Config::get<int32_t>(expectedReportName).value_or(defaultExpectedReport) };
+		const int periods{ Config::get<int32_t>(stallPeriodsName).value_or(defaultStallPeriods) };
+		stallAfter = milliseconds(std::max(1, period * periods));
+		probeInterval = milliseconds(Config::get<int32_t>(probeIntervalName).value_or(defaultProbeInterval));
+	}
+
+	int StallWatchdog::readTimeout() const {
+		return timeoutMs;
+	}
+
+	bool StallWatchdog::shouldPoll(clock::time_point now) {
+		if (!isStalled) {
+			return true;
+		}
+		if (now < lastProbe + probeInterval) {
+			return false;
+		}
+		lastProbe = now;
+		++totals.probes;
+		return true;
+	}
+
+	void StallWatchdog::reportReceived(clock::time_point now) {
+		lastReport = now;
+		missed = false;
+		if (isStalled) {
+			isStalled = false;
+			++totals.recoveries;
+		}
+	}
+
+	void StallWatchdog::reportMissed(clock::time_point now) {
+		++totals.readTimeouts;
+		missed = true;
+		if (!isStalled && now >= lastReport + stallAfter) {
+			isStalled = true;
+			lastProbe = now;
+			++totals.stalls;
+		}
+	}
+
+	bool StallWatchdog::answering() const {
+		return !missed;
+	}
+
+	bool StallWatchdog::stalled() const {
+		return isStalled;
+	}
+
+	WatchdogStats StallWatchdog::stats() const {
+		return totals;
+	}
+
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+
+namespace Procon {
+
+	struct WatchdogStats {
+		size_t readTimeouts{ 0 }; // Reads that hit iReadTimeoutMs or failed
+		size_t stalls{ 0 }; // Times the controller was isolated
+		size_t recoveries{ 0 }; // Times an isolated controller answered again
+		size_t probes{ 0 }; // Polls sent to an isolated controller
+	};
+
+	// Per-controller stall detection.
+	// Every read is bounded by iReadTimeoutMs. Once one has timed out the
+	// controller stops answering and is only probed: a poll is sent and its
+	// reply picked up without waiting, so a quiet controller blocks the loop
+	// for one timeout at most. If no report arrives for
+	// iStallPeriods * iExpectedReportMs the controller is considered stalled and
+	// is only probed every iStallProbeIntervalMs. Any report brings it back.
+	class StallWatchdog {
+	public:
+		using clock = std::chrono::steady_clock;
+
+		explicit StallWatchdog(clock::time_point start);
+
+		int readTimeout() const;
+		bool shouldPoll(clock::time_point now);
+		void reportReceived(clock::time_point now);
+		void reportMissed(clock::time_point now);
+
+		// False from a missed read until the next report
+		bool answering() const;
+		bool stalled() const;
+		WatchdogStats stats() const;
+
+	private:
+		int timeoutMs;
+		clock::duration stallAfter;
+		clock::duration probeInterval;
+
+		bool isStalled{ false };
+		bool missed{ false };
+		clock::time_point lastReport;
+		clock::time_point lastProbe;
+		WatchdogStats totals{};
+	};
+
+};
@@ -3,6 +3,11 @@
 #include <chrono> // milliseconds
 #include <vector>
 #include <array>
+#include <string>
+#include <cstdlib> // atof
+#include <iomanip> // setw, setfill
+#include <fstream> // ofstream
+#include <algorithm> // any_of
 
 #ifndef NOMINMAX
 #define NOMINMAX
@@ -16,6 +21,14 @@
 #include "Cerberus.hpp"
 #include "Version.hpp"
 #include "Config.hpp"
+#include "Consumer.hpp"
+#include "Profiles.hpp"
+#include "LatencyRig.hpp"
+#include "PollBench.hpp"
+#include "Simulation.hpp"
+#include "Slots.hpp"
+#include "StreamBench.hpp"
+#include "Usage.hpp"
 
 namespace {
 	bool hasBroke{ false };
@@ -44,6 +57,51 @@ namespace {
 		return e == XOutput::XOUTPUT_SUCCESS;
 	}
 
+	using steady = std::chrono::steady_clock;
+	constexpr auto reattachScanInterval = std::chrono::seconds(1);
+	const std::string usageStatsName{ "bUsageStats" };
+	const std::string usageFileName{ "sUsageStatsFile" };
+	const std::string usageIntervalName{ "iUsageStatsIntervalS" };
+	const std::string defaultUsageFile{ "usage.txt" };
+	constexpr int defaultUsageInterval{ 60 };
+
+	// Work the main loops do now and then rather than every pass
+	struct Housekeeping {
+		steady::time_point nextScan{ steady::now() };
+		steady::duration usageInterval{ 0 }; // 0 only writes usage stats on exit
+		steady::time_point nextUsage{ steady::now() };
+	};
+
+	// Rewrites sUsageStatsFile with every controller's usage so far
+	void writeUsageStats(const std::vector<Procon::Controller> &cs) {
+		const std::string file{ Procon::Config::get<std::string>(usageFileName).value_or(defaultUsageFile) };
+		std::ofstream out{ file, std::ios::trunc };
+		const auto now = steady::now();
+		for (const Procon::Controller &c : cs) {
+			if (const Procon::UsageTracker *usage = c.getUsage()) {
+				out << "[Controller LED " << c.getPort() + 1 << ' ' << c.getIdentity().macString() << "]\n";
+				usage->write(out, now);
+				out << '\n';
+			}
+		}
+	}
+
+	void housekeeping(std::vector<Procon::Controller> &cs, Housekeeping &h) {
+		const auto now = steady::now();
+		// Every reattachScanInterval while a controller is gone and its slot
+		// still held, look for it among the devices
+		if (now >= h.nextScan) {
+			h.nextScan = now + reattachScanInterval;
+			if (std::any_of(cs.begin(), cs.end(), [](const Procon::Controller &c) { return c.awaitingDevice(); })) {
+				Procon::reattachControllers(cs);
+			}
+		}
+		if (h.usageInterval > steady::duration::zero() && now >= h.nextUsage) {
+			h.nextUsage = now + h.usageInterval;
+			writeUsageStats(cs);
+		}
+	}
+
 	void pause() {
 		while (_kbhit() != 0) _getch(); // Eat any buffered input
 		std::cout << "Press any key to continue..." << std::endl; // Intentional use of endl to flush output buffer
@@ -53,37 +111,81 @@ namespace {
 	}
 }
 
-// argc and argv are unused
-int main(int, char*[]) {
+// --latency-rig measures input latency with a simulated controller instead of running,
+// --poll-bench measures report decoding with several polling threads,
+// --simulate [hours] runs scripted controllers in virtual time,
+// --reader only reads the controllers and streams their reports, without ScpVBus,
+// --consumer feeds virtual pads from the streams of a running --reader,
+// --stream-bench measures report stream latency to a consumer process
+int main(int argc, char* argv[]) {
 	using std::cout;
 	using std::this_thread::yield;
 	using namespace Procon;
 
+	const std::string mode{ argc > 1 ? argv[1] : "" };
+	// The stream bench's consumer shares the bench's console, only the bench itself pauses
+	const bool benchConsumer{ mode == streamBenchConsumerArg };
+
 	// Pause before exiting
-	auto pause = make_scoped(::pause);
+	auto pause = make_scoped([benchConsumer] {
+		if (!benchConsumer) {
+			::pause();
+		}
+	});
 
-	cout << ProgramName << ' ' << ProgramVersion << ' ' << Platform << ' ' << BuildType << "\n\n";
+	if (!benchConsumer) {
+		cout << ProgramName << ' ' << ProgramVersion << ' ' << Platform << ' ' << BuildType << "\n\n";
+	}
 
 	try {
 		Config::readConfigFile("config.txt");
+		Profiles::load();
 	}
 	catch (const ConfigError &e) {
 		cout << "Error reading config file: " << e.what() << '\n';
 		return -1;
 	}
 
-	try {
-		XOutput::XOutputInitialize();
+	if (mode == "--poll-bench") {
+		return runPollBench(cout);
 	}
-	catch (XOutput::XOutputError &e) {
-		cout << e.what() << '\n';
-		return -1;
+	if (mode == "--simulate") {
+		return runSimulation(cout, argc > 2 ? std::atof(argv[2]) : 1.0);
+	}
+	if (mode == "--stream-bench") {
+		return runStreamBench(cout);
 	}
 
-	DWORD unused;
-	if (!SUCCESS(XOutput::XOutputGetRealUserIndex(0, &unused))) {
-		cout << "Unable to connect to ScpVBus.\n";
-		return -1;
+	// The reader only needs the controllers, the virtual pads are the consumers'
+	const bool reader{ mode == "--reader" };
+	if (!reader) {
+		try {
+			XOutput::XOutputInitialize();
+		}
+		catch (XOutput::XOutputError &e) {
+			cout << e.what() << '\n';
+			return -1;
+		}
+
+		DWORD unused;
+		if (!SUCCESS(XOutput::XOutputGetRealUserIndex(0, &unused))) {
+			cout << "Unable to connect to ScpVBus.\n";
+			return -1;
+		}
+	}
+
+	if (mode == "--latency-rig") {
+		return runLatencyRig(cout);
+	}
+	if (benchConsumer) {
+		return runStreamBenchConsumer(cout, argc > 2 ? argv[2] : "0");
+	}
+	if (mode == "--consumer") {
+		cout << "Press CTRL+C to exit.\n\n";
+		::setBreakHandler();
+		Profiles::startWatcher();
+		auto stopWatcher = make_scoped(Profiles::stopWatcher);
+		return runConsumer(cout, ::hasBroke);
 	}
 
 #ifndef NO_CERBERUS
@@ -100,27 +202,54 @@ int main(int, char*[]) {
 #endif
 	
 	std::vector<Controller> cs;
+	cs.reserve(maxSlots);
 	uchar port{ 0 };
 	{
 		constexpr auto id = Procon_ID; // Procon only for now
 		constexpr auto vendorId = NintendoID;
 		hid_device_info * const devs = hid_enumerate(vendorId, id); // Don't trust hidapi, returns non-matching devices sometimes (*const to prevent compiler from optimizing away)
 		hid_device_info *iter = devs;
-		do {
-			if (iter != nullptr) {
-				if (iter->product_id == id) { // Check the id!
-					try {
+		try {
+			do {
+				if (iter != nullptr) {
+					if (iter->product_id == id) { // Check the id!
 						cs.emplace_back(Controller(port++));
-						cs.back().openDevice(iter);
-					}
-					catch (ControllerException &e) {
-						cout << "Exception connecting to controller: " << e.what() << '\n';
-						return -1;
+						if (reader) {
+							cs.back().streamReports();
+						}
+						cs.back().beginOpen(iter);
 					}
+					iter = iter->next;
+				}
+			} while (iter != nullptr && port < maxSlots);
+			// Every controller's setup runs at once, none waits on another's replies
+			bool settingUp{ true };
+			while (settingUp) {
+				settingUp = false;
+				for (Controller &c : cs) {
+					settingUp = c.pumpCommands() || settingUp;
 				}
-				iter = iter->next;
+				yield();
+			}
+			for (Controller &c : cs) {
+				c.finishOpen();
+				const ControllerIdentity &identity = c.getIdentity();
+				cout << "Controller LED " << c.getPort() + 1 << ": " << identity.macString()
+					<< ", firmware " << static_cast<int>(identity.firmwareMajor) << '.' << static_cast<int>(identity.firmwareMinor)
+					<< std::hex << std::setfill('0') << ", colors #" << std::setw(6) << identity.bodyColor
+					<< " #" << std::setw(6) << identity.buttonColor << std::dec << std::setfill(' ') << '\n';
 			}
-		} while (iter != nullptr && port < 4);
+		}
+		catch (ControllerException &e) {
+			cout << "Exception connecting to controller: " << e.what() << '\n';
+			hid_free_enumeration(devs);
+			return -1;
+		}
+		catch (const ConfigError &e) {
+			cout << "Error in config file: " << e.what() << '\n';
+			hid_free_enumeration(devs);
+			return -1;
+		}
 		hid_free_enumeration(devs);
 	}
 	if (cs.size() == 0) {
@@ -128,44 +257,66 @@ int main(int, char*[]) {
 		return -1;
 	}
 
-	cout << "\nConnected to " << static_cast<int>(port) << " controller(s). Beginning xInput emulation.\n\n";
+	if (reader) {
+		cout << "\nConnected to " << static_cast<int>(port) << " controller(s). Streaming reports for ProconXInput --consumer.\n\n";
+	}
+	else {
+		cout << "\nConnected to " << static_cast<int>(port) << " controller(s). Beginning xInput emulation.\n\n";
 	
-	cout << "Doing calibration, stick min/maxes will be updated automatically.\n";
-	cout << "Move the sticks some, then let them reset to neutral.\n";
-	cout << "Press the Share button to set stick center. This only works once per controller currently!\n";
-	cout << "XInput may be laggier before stick center for all controllers is set!\n\n";
+		cout << "Doing calibration, stick min/maxes will be updated automatically.\n";
+		cout << "Move the sticks some, then let them reset to neutral.\n";
+		cout << "Press the Share button to set stick center. This only works once per controller currently!\n";
+		cout << "XInput may be laggier before stick center for all controllers is set!\n\n";
+	}
 	
 	cout << "Press CTRL+C to exit.\n\n";
 	::setBreakHandler();
 
+	Profiles::startWatcher();
+	auto stopWatcher = make_scoped(Profiles::stopWatcher);
+
 	std::array<bool, 4> hasCentered;
 	hasCentered.fill(false);
+	if (!reader) {
+		// The centering loop reads getState() until each controller is centered
+		for (Controller &c : cs) {
+			c.addStateReader();
+		}
+	}
 
+	Housekeeping chores;
+	if (Config::get<bool>(usageStatsName).value_or(false)) {
+		chores.usageInterval = std::chrono::seconds(Config::get<int32_t>(usageIntervalName).value_or(defaultUsageInterval));
+		chores.nextUsage += chores.usageInterval;
+	}
 	try {
 		// Testing to set centers, additional comparisons = slower so make it a separate loop
 		size_t countCentered{ 0 };
-		while (!::hasBroke && countCentered < port) {
+		// Consumers calibrate from the stream, the reader goes straight to the fast loop
+		while (!::hasBroke && !reader && countCentered < port) {
 			for (size_t i = 0; i < port; ++i) {
 				cs[i].pollInput();
 				if (!hasCentered[i]) {
-					const Procon::ExpandedPadState &state = cs[i].getState();
+					const Procon::ExpandedPadState state = cs[i].getState();
 					if (state.sharePressed) {
 						cs[i].setCalibrationCenter(state.leftStick, state.rightStick);
+						cs[i].removeStateReader(); // Nothing reads it after centering
 						hasCentered[i] = true;
 						++countCentered;
-						cout << "Set stick centers for controller LED " << i + 1 << '\n';
+						cout << "Set stick centers for controller LED " << cs[i].getPort() + 1 << '\n';
 					}
 				}
 			}
+			housekeeping(cs, chores);
 			yield();
 		}
-		cout << "\nAll controller stick centers set, entering fast input loop. Enjoy your games!\n";
+		if (!reader) {
+			cout << "\nAll controller stick centers set, entering fast input loop. Enjoy your games!\n";
+		}
 		// Centers set, main input loop
 		while(!::hasBroke){
-			for (size_t i = 0; i < port; ++i) {
-				cs[i].pollInput();
-			}
-			yield(); // sleep_for causes big lag and not yielding eats way more processor
+			pollControllers(cs, Clock::steady());
+			housekeeping(cs, chores);
 		}
 	}
 	catch (ControllerException &e) {
@@ -173,5 +324,25 @@ int main(int, char*[]) {
 		return -1;
 	}
 
+	if (std::any_of(cs.begin(), cs.end(), [](const Controller &c) { return c.getUsage() != nullptr; })) {
+		writeUsageStats(cs);
+	}
+	for (const Controller &c : cs) {
+		using std::chrono::duration_cast;
+		using std::chrono::seconds;
+		const IdleStats stats = c.getIdleStats();
+		const WatchdogStats watchdog = c.getWatchdogStats();
+		const OutputStats output = c.getOutputStats();
+		cout << "Controller LED " << c.getPort() + 1 << ": "
+			<< duration_cast<seconds>(stats.activeTime).count() << "s active, "
+			<< duration_cast<seconds>(stats.idleTime).count() << "s idle, "
+			<< stats.skippedPolls << " polls skipped, "
+			<< watchdog.readTimeouts << " read timeouts, "
+			<< watchdog.stalls << " stalls, "
+			<< output.deferred << " feedback updates deferred, "
+			<< output.dropped << " rumble updates dropped, "
+			<< c.getInvalidReports() << " invalid reports dropped\n";
+	}
+
 	return 0;
 }